@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace Athernet {
+
+// Packed bit vector, bit i lives in word i / 64 at position i % 64.
+// Numbers are appended LSB first, same order as the bits go on air.
+// Bits past size() in the last word are always zero.
+class BitBuffer {
+public:
+	BitBuffer() = default;
+
+	// num_bits zeros
+	explicit BitBuffer(int num_bits)
+		: m_words((num_bits + 63) >> 6)
+		, m_size { num_bits }
+	{
+	}
+
+	// one int per bit
+	explicit BitBuffer(const std::vector<int>& bits)
+	{
+		reserve(static_cast<int>(bits.size()));
+		for (auto x : bits)
+			push_back(x);
+	}
+
+	// LSB of bytes[0] first
+	static BitBuffer from_bytes(std::span<const uint8_t> bytes)
+	{
+		BitBuffer ret(static_cast<int>(bytes.size()) * 8);
+		for (size_t i = 0; i < bytes.size(); ++i) {
+			ret.m_words[i >> 3] |= static_cast<uint64_t>(bytes[i]) << ((i & 7) << 3);
+		}
+		return ret;
+	}
+
+	// inverse of from_bytes, last byte zero padded
+	std::vector<uint8_t> to_bytes() const
+	{
+		std::vector<uint8_t> ret((m_size + 7) >> 3);
+		for (size_t i = 0; i < ret.size(); ++i) {
+			ret[i] = static_cast<uint8_t>(m_words[i >> 3] >> ((i & 7) << 3));
+		}
+		return ret;
+	}
+
+	std::vector<int> to_vector() const
+	{
+		std::vector<int> ret(m_size);
+		for (int i = 0; i < m_size; ++i)
+			ret[i] = (*this)[i];
+		return ret;
+	}
+
+	int size() const { return m_size; }
+
+	bool empty() const { return m_size == 0; }
+
+	void clear()
+	{
+		m_words.clear();
+		m_size = 0;
+	}
+
+	void reserve(int num_bits) { m_words.reserve((num_bits + 63) >> 6); }
+
+	// zero filled when growing
+	void resize(int num_bits)
+	{
+		m_words.resize((num_bits + 63) >> 6);
+		m_size = num_bits;
+		clear_tail();
+	}
+
+	int operator[](int i) const { return static_cast<int>((m_words[i >> 6] >> (i & 63)) & 1); }
+
+	int back() const { return (*this)[m_size - 1]; }
+
+	void set(int i, int bit)
+	{
+		uint64_t mask = 1ULL << (i & 63);
+		m_words[i >> 6] = bit ? (m_words[i >> 6] | mask) : (m_words[i >> 6] & ~mask);
+	}
+
+	void push_back(int bit) { append(bit ? 1 : 0, 1); }
+
+	void pop_back() { resize(m_size - 1); }
+
+	// low num_bits of value, LSB first
+	void append(uint64_t value, int num_bits)
+	{
+		assert(num_bits >= 0 && num_bits <= 64);
+		if (!num_bits)
+			return;
+		if (num_bits < 64)
+			value &= (1ULL << num_bits) - 1;
+
+		int offset = m_size & 63;
+		if (!offset)
+			m_words.push_back(0);
+		m_words.back() |= value << offset;
+		if (offset + num_bits > 64) {
+			m_words.push_back(value >> (64 - offset));
+		}
+		m_size += num_bits;
+	}
+
+	void append(const BitBuffer& other) { append(other, 0, other.size()); }
+
+	// other[begin, end)
+	void append(const BitBuffer& other, int begin, int end)
+	{
+		reserve(m_size + end - begin);
+		for (int i = begin; i < end; i += 64) {
+			int num_bits = std::min(64, end - i);
+			append(other.extract(i, num_bits), num_bits);
+		}
+	}
+
+	// num_bits starting at pos, bits past size() read as zero
+	uint64_t extract(int pos, int num_bits) const
+	{
+		assert(num_bits >= 0 && num_bits <= 64);
+		if (!num_bits || pos >= m_size)
+			return 0;
+		int word = pos >> 6, offset = pos & 63;
+		uint64_t value = m_words[word] >> offset;
+		if (offset && offset + num_bits > 64 && word + 1 < static_cast<int>(m_words.size())) {
+			value |= m_words[word + 1] << (64 - offset);
+		}
+		if (num_bits < 64)
+			value &= (1ULL << num_bits) - 1;
+		return value;
+	}
+
+	BitBuffer slice(int begin, int end) const
+	{
+		BitBuffer ret;
+		ret.append(*this, begin, end);
+		return ret;
+	}
+
+	// this[offset + i] ^= other[i]
+	void xor_with(const BitBuffer& other, int offset = 0)
+	{
+		assert(offset + other.size() <= m_size);
+		for (int i = 0; i < other.size(); i += 64) {
+			int num_bits = std::min(64, other.size() - i);
+			xor_bits(offset + i, other.extract(i, num_bits), num_bits);
+		}
+	}
+
+	// this[pos, pos + num_bits) ^= value
+	void xor_bits(int pos, uint64_t value, int num_bits)
+	{
+		if (num_bits < 64)
+			value &= (1ULL << num_bits) - 1;
+		int word = pos >> 6, offset = pos & 63;
+		m_words[word] ^= value << offset;
+		if (offset && offset + num_bits > 64) {
+			m_words[word + 1] ^= value >> (64 - offset);
+		}
+	}
+
+	const uint64_t* words() const { return m_words.data(); }
+	uint64_t* words() { return m_words.data(); }
+	int num_words() const { return static_cast<int>(m_words.size()); }
+
+	bool operator==(const BitBuffer& other) const = default;
+
+private:
+	void clear_tail()
+	{
+		if (m_size & 63)
+			m_words.back() &= (1ULL << (m_size & 63)) - 1;
+	}
+
+	std::vector<uint64_t> m_words;
+	int m_size = 0;
+};
+
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "BitBuffer.hpp"
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+namespace Athernet {
+
+// Table driven CRC (width <= 32) over bits in on-air order.
+// Bits go LSB first, so this is the reflected algorithm: the register holds the remainder with
+// the x^(width-1) coefficient in bit 0, which is also the order the residual is appended in.
+// init = 0 and no final xor, so message || residual always leaves a zero remainder.
+// Whole 64-bit words go through slice-by-8 tables, at any bit alignment.
+class CRC {
+public:
+	// generator coefficients from x^width down to x^0, e.g. Config::get_crc()
+	CRC(const std::vector<int>& generator)
+		: CRC(static_cast<int>(generator.size()) - 1, reflect_generator(generator))
+	{
+	}
+
+	CRC(int width, uint32_t reflected_poly)
+		: m_width { width }
+		, m_poly { reflected_poly }
+	{
+		assert(width > 0 && width <= 32);
+
+		for (uint32_t b = 0; b < 256; ++b) {
+			uint32_t crc = b;
+			for (int i = 0; i < 8; ++i) {
+				crc = (crc & 1) ? (crc >> 1) ^ m_poly : (crc >> 1);
+			}
+			m_table[0][b] = crc;
+		}
+		for (int k = 1; k < 8; ++k) {
+			for (int b = 0; b < 256; ++b) {
+				m_table[k][b] = (m_table[k - 1][b] >> 8) ^ m_table[0][m_table[k - 1][b] & 0xff];
+			}
+		}
+	}
+
+	// * CRC-16/KERMIT polynomial (0x1021)
+	static const CRC& crc16()
+	{
+		static CRC instance(16, 0x8408);
+		return instance;
+	}
+
+	// * CRC-32 polynomial (0x04C11DB7)
+	static const CRC& crc32()
+	{
+		static CRC instance(32, 0xEDB88320);
+		return instance;
+	}
+
+	int width() const { return m_width; }
+
+	// feed num_bits (<= 64) of value, LSB first
+	uint32_t update_bits(uint32_t crc, uint64_t value, int num_bits) const
+	{
+		if (num_bits == 64) {
+			return update_word(crc, value);
+		}
+		for (; num_bits >= 8; num_bits -= 8, value >>= 8) {
+			crc = (crc >> 8) ^ m_table[0][(crc ^ value) & 0xff];
+		}
+		for (; num_bits > 0; --num_bits, value >>= 1) {
+			crc ^= value & 1;
+			crc = (crc & 1) ? (crc >> 1) ^ m_poly : (crc >> 1);
+		}
+		return crc;
+	}
+
+	// feed bytes, LSB of bytes[0] first
+	uint32_t update_bytes(uint32_t crc, const uint8_t* data, size_t count) const
+	{
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			uint64_t word = 0;
+			for (int j = 0; j < 8; ++j)
+				word |= static_cast<uint64_t>(data[i + j]) << (j * 8);
+			crc = update_word(crc, word);
+		}
+		for (; i < count; ++i) {
+			crc = (crc >> 8) ^ m_table[0][(crc ^ data[i]) & 0xff];
+		}
+		return crc;
+	}
+
+	// feed bits[begin, end), can be called repeatedly as bits arrive
+	uint32_t update(uint32_t crc, const BitBuffer& bits, int begin, int end) const
+	{
+		for (; begin + 64 <= end; begin += 64) {
+			crc = update_word(crc, bits.extract(begin, 64));
+		}
+		return update_bits(crc, bits.extract(begin, end - begin), end - begin);
+	}
+
+	uint32_t compute(const BitBuffer& bits, int begin, int end) const { return update(0, bits, begin, end); }
+
+	// message || residual passes
+	bool check(const BitBuffer& bits, int begin, int end) const { return compute(bits, begin, end) == 0; }
+
+	// append width() residual bits
+	void append(BitBuffer& frame) const { frame.append(compute(frame, 0, frame.size()), m_width); }
+
+private:
+	static uint32_t reflect_generator(const std::vector<int>& generator)
+	{
+		// coefficient of x^(width - 1 - k) goes to bit k
+		uint32_t poly = 0;
+		for (size_t k = 1; k < generator.size(); ++k) {
+			poly |= static_cast<uint32_t>(generator[k]) << (k - 1);
+		}
+		return poly;
+	}
+
+	// slice-by-8
+	uint32_t update_word(uint32_t crc, uint64_t word) const
+	{
+		uint64_t v = word ^ crc;
+		return m_table[7][v & 0xff] ^ m_table[6][(v >> 8) & 0xff] ^ m_table[5][(v >> 16) & 0xff]
+			^ m_table[4][(v >> 24) & 0xff] ^ m_table[3][(v >> 32) & 0xff] ^ m_table[2][(v >> 40) & 0xff]
+			^ m_table[1][(v >> 48) & 0xff] ^ m_table[0][v >> 56];
+	}
+
+	int m_width;
+	uint32_t m_poly;
+	std::array<std::array<uint32_t, 256>, 8> m_table;
+};
+
+}
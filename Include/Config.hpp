@@ -1,6 +1,8 @@
 #pragma once
 
+#include "CRC.hpp"
 #include "Logger.hpp"
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <cmath>
@@ -25,7 +27,21 @@ constexpr int SEND_FLOAT_INT_SCALE = 1000;
 constexpr int RECV_FLOAT_INT_SCALE = 1'000;
 
 // * If dump received
-constexpr int DUMP_RECEIVED = 1;
+#ifndef ATHERNET_DUMP_RECEIVED
+#define ATHERNET_DUMP_RECEIVED 1
+#endif
+constexpr int DUMP_RECEIVED = ATHERNET_DUMP_RECEIVED;
+
+// * Preamble detection (float only): preambles at least this long are correlated with the
+// overlap-save FFT, shorter ones with the sliding dot product, which is cheaper there
+constexpr int PREAMBLE_DETECTOR_FFT_MIN_LENGTH = 256;
+
+// * Payload modulation of a data frame, control_section bits 5 - 6 (see PHY_OFDM.hpp);
+// preamble, length and MAC header are always 4B5B + NRZI
+enum class Modulation { NRZI_4B5B, OFDM_QPSK, OFDM_16QAM };
+
+// * Convolutional code of a payload (see PHY_FEC.hpp), in the PHY header after the length field
+enum class CodeRate { NONE, R1_2, R2_3, R3_4 };
 
 // put preambles, ring buffer size ... etc inside.
 // Singleton
@@ -170,16 +186,110 @@ public:
 	// get buffer size for physical layer
 	int get_physical_buffer_size() const { return physical_buffer_size; }
 
+	// longest contiguous window of a ring buffer
+	int get_max_view_length() const { return max_view_length; }
+
 	int get_phy_frame_payload_symbol_limit() const { return phy_frame_payload_symbol_limit; }
 
 	int get_phy_frame_length_num_bits() const { return phy_frame_length_num_bits; }
 
+	// code rate field after the length, the 2 bit rate twice: a mismatch counts as a bad length
+	int get_phy_frame_code_num_bits() const { return 4; }
+
 	int get_preamble_length() const { return preamble_length; }
 
 	int get_crc_length() const { return static_cast<int>(crc.size()); }
 	int get_crc_residual_length() const { return static_cast<int>(crc.size()) - 1; }
 
-	int get_phy_coding_overhead() const { return phy_coding_overhead; }
+	// * Fountain code: a coded frame is block count | symbol id | chunk | transfer | symbol (see Fountain.hpp)
+	// files are sent as chunks of this many source blocks, also the block count a file is split
+	// into when the symbol size is left to follow from the file size
+	int get_lt_num_blocks() const { return lt_num_blocks; }
+	// bits per symbol, 0 splits a file into get_lt_num_blocks() blocks
+	int get_lt_symbol_bits() const { return lt_symbol_bits; }
+	// the first symbols are the source blocks themselves
+	bool get_lt_systematic() const { return lt_systematic; }
+	// parity blocks of the precode per source block, 0 = plain LT
+	double get_lt_precode_ratio() const { return lt_precode_ratio; }
+	// Robust Soliton parameters
+	double get_lt_soliton_c() const { return lt_soliton_c; }
+	double get_lt_soliton_delta() const { return lt_soliton_delta; }
+	int get_lt_min_repair_degree() const { return lt_min_repair_degree; }
+	// symbols per source block sent when the receiver can't tell us it is done
+	double get_lt_blind_overhead() const { return lt_blind_overhead; }
+
+	int get_lt_block_count_bits() const { return lt_block_count_bits; }
+	int get_lt_symbol_id_bits() const { return lt_symbol_id_bits; }
+	int get_lt_chunk_bits() const { return lt_chunk_bits; }
+	int get_lt_transfer_bits() const { return lt_transfer_bits; }
+	// chunks the sender has in flight at once, the receiver decodes them in parallel
+	int get_lt_parallel_chunks() const { return lt_parallel_chunks; }
+
+	int get_phy_coding_overhead() const
+	{
+		return lt_block_count_bits + lt_symbol_id_bits + lt_chunk_bits + lt_transfer_bits;
+	}
+
+	// the receiver's completion report in ACK frames: transfer | chunk | whole file
+	int get_lt_report_bits() const { return lt_transfer_bits + lt_chunk_bits + 1; }
+
+	void set_lt_num_blocks(int num_blocks) { lt_num_blocks = num_blocks; }
+	void set_lt_symbol_bits(int bits) { lt_symbol_bits = bits; }
+	void set_lt_systematic(bool systematic) { lt_systematic = systematic; }
+	void set_lt_precode_ratio(double ratio) { lt_precode_ratio = ratio; }
+	void set_lt_parallel_chunks(int chunks) { lt_parallel_chunks = chunks; }
+
+	// * OFDM payloads (see PHY_OFDM.hpp): subcarriers first .. first + n - 1 of an FFT of this size,
+	// one in every get_ofdm_pilot_spacing() a pilot; both ends must agree, set before the PHY is built
+	int get_ofdm_fft_size() const { return ofdm_fft_size; }
+	int get_ofdm_cp_length() const { return ofdm_cp_length; }
+	int get_ofdm_first_subcarrier() const { return ofdm_first_subcarrier; }
+	int get_ofdm_num_subcarriers() const { return ofdm_num_subcarriers; }
+	int get_ofdm_pilot_spacing() const { return ofdm_pilot_spacing; }
+	// sent RMS, peaks are clipped to full scale
+	float get_ofdm_rms() const { return 0.35f; }
+
+	void set_ofdm_num_subcarriers(int num_subcarriers) { ofdm_num_subcarriers = num_subcarriers; }
+	void set_ofdm_cp_length(int cp_length) { ofdm_cp_length = cp_length; }
+
+	// data frames of a new MAC_Sender, see MAC_Sender::set_modulation / set_code_rate
+	Modulation get_phy_modulation() const { return Modulation::NRZI_4B5B; }
+	CodeRate get_phy_code_rate() const { return CodeRate::NONE; }
+
+	// * link adaptation (MAC_Sender::set_link_adaptation): every frame reports the SNR of the last
+	// frame from the peer in get_link_report_bits() bits after the MAC header, the sender takes the
+	// fastest modulation and code rate whose get_mcs_min_snr() less get_mcs_coding_gain() the report
+	// meets, get_mcs_hysteresis() dB above it to move up
+	bool get_phy_link_adaptation() const { return true; }
+	int get_link_report_bits() const { return 8; }
+	int get_mcs_min_snr(Modulation modulation) const
+	{
+		switch (modulation) {
+		case Modulation::OFDM_QPSK:
+			return 10;
+		case Modulation::OFDM_16QAM:
+			return 17;
+		default:
+			return 0;
+		}
+	}
+	// dB the convolutional code at rate (soft decision Viterbi) takes off get_mcs_min_snr()
+	int get_mcs_coding_gain(CodeRate rate) const
+	{
+		switch (rate) {
+		case CodeRate::R1_2:
+			return 5;
+		case CodeRate::R2_3:
+			return 4;
+		case CodeRate::R3_4:
+			return 3;
+		default:
+			return 0;
+		}
+	}
+	int get_mcs_hysteresis() const { return 2; }
+	// data frames sent a step down after one was lost
+	int get_mcs_loss_hold() const { return 8; }
 
 	// * Tag dispatch
 	const std::vector<float>& get_preamble(Tag<float>) const { return preamble; }
@@ -198,6 +308,29 @@ public:
 
 	const std::vector<int>& get_crc() const { return crc; }
 
+	// * CRC of the MAC header, always the CRC8 above
+	const CRC& get_header_crc() const { return header_crc; }
+
+	// * CRC of the payload, CRC8 / CRC16 / CRC32 (both ends must agree)
+	const CRC& get_payload_crc() const
+	{
+		switch (payload_crc_length) {
+		case 16:
+			return CRC::crc16();
+		case 32:
+			return CRC::crc32();
+		default:
+			return header_crc;
+		}
+	}
+
+	// 8, 16 or 32; set on both ends before any frame goes out
+	void set_payload_crc_length(int length)
+	{
+		assert(length == 8 || length == 16 || length == 32);
+		payload_crc_length = length;
+	}
+
 	void set_self_id(int addr) { mac_address = addr; }
 	int get_self_id() { return mac_address; }
 
@@ -221,15 +354,55 @@ public:
 
 	bool is_router() { return get_self_id() == 0; }
 
+	// * the thresholds below are tuned on quiet sound cards; a noisier input (a simulated channel at
+	// low SNR) raises them, or noise alone reads as a busy channel / a collision and nothing is sent.
+	// stddev of the input noise, 0 for the tuned values
+	void set_noise_floor(float noise) { noise_floor = noise; }
+	float get_noise_floor() const { return noise_floor; }
+
+	// |sample| above which the channel is busy (carrier sense); noise gets there once in ~2M samples
+	float get_carrier_sense_threshold() const { return std::max(0.01f, 5 * noise_floor); }
+
+	// mean x^4 above which a collision is called, 10 times what noise has (3 * stddev^4)
 	// float get_collision_threshold() const { return 0.0002f; }
-	float get_collision_threshold() const { return 0.0005; }
+	float get_collision_threshold() const { return std::max(0.0005f, 30 * std::pow(noise_floor, 4.0f)); }
+	// * x^4 of an OFDM payload is 3 * rms^4, ~1/20 of NRZI at the same peak; another node's NRZI on
+	// top of it would stay under the threshold above
+	float get_ofdm_collision_threshold() const { return std::max(0.00003f, 30 * std::pow(noise_floor, 4.0f)); }
 
+	// sender window to start with, it grows and shrinks with the losses (see SenderSlidingWindow)
 	int get_window_size() const { return 3; }
 
+	// * selective repeat: sender and receiver windows together fit in the sequence space
+	int get_max_window_size() const { return get_seq_limit() / 2; }
+
 	int get_seq_bits_length() const { return 8; }
 
 	int get_seq_limit() const { return 1 << get_seq_bits_length(); }
 
+	// SACK bitmap in ACK frames: frames received after the cumulative ACK and the first one missing
+	// after it (ack + 2 on)
+	int get_sack_bits() const { return 24; }
+
+	// * the sender window goes no further than the SACK bitmap reaches, a frame past it could only be
+	// ACKed cumulatively
+	int get_max_send_window_size() const { return std::min(get_max_window_size(), get_sack_bits() + 1); }
+
+	// resend a frame not ACKed after this many Protocol_Control::clock ticks (audio callbacks)
+	// until there is an RTT to go by, doubled on every retry
+	int get_retransmit_timeout() const { return 400; }
+
+	// bounds of the timeout from SRTT / RTTVAR, ticks
+	int get_min_retransmit_timeout() const { return 200; }
+	int get_max_retransmit_timeout() const { return 4000; }
+
+	int get_max_retransmit_backoff() const { return 3; }
+
+	// standalone ACKs wait this many ticks for data to ride on or more frames to cover
+	int get_ack_delay() const { return 16; }
+
+	int get_max_ack_copies() const { return 4; }
+
 	int get_map_4b_5b(int x)
 	{
 		assert(x >= 0 && x < 16);
@@ -269,11 +442,32 @@ private:
 
 	int phy_frame_CP_length;
 
+	float noise_floor = 0;
+
 	int phy_frame_payload_symbol_limit = 4095;
 	int phy_frame_length_num_bits = 12;
 
-	// 7 for windows start position, 19 for window itself
-	int phy_coding_overhead = 7 + 19;
+	int lt_num_blocks = 100;
+	int lt_symbol_bits = 0;
+	bool lt_systematic = true;
+	double lt_precode_ratio = 0.05;
+	double lt_soliton_c = 0.05;
+	double lt_soliton_delta = 0.5;
+	int lt_min_repair_degree = 24;
+	double lt_blind_overhead = 1.25;
+	int lt_block_count_bits = 16;
+	int lt_symbol_id_bits = 20;
+	int lt_chunk_bits = 16;
+	// * a restarted sender picks a random id, the receiver remembers 16 finished ones
+	int lt_transfer_bits = 24;
+	int lt_parallel_chunks = 4;
+
+	// 750 Hz apart, 1.5 kHz .. 21.75 kHz
+	int ofdm_fft_size = 64;
+	int ofdm_cp_length = 16;
+	int ofdm_first_subcarrier = 2;
+	int ofdm_num_subcarriers = 28;
+	int ofdm_pilot_spacing = 7;
 
 	int mac_address = -1;
 	std::string ip_address = "";
@@ -321,9 +515,13 @@ private:
 
 	// ! REVERSED for simplicity
 	std::vector<int> crc = { 1, 1, 1, 0, 1, 0, 1, 0, 1 }; // CRC8
+	CRC header_crc { crc };
+	int payload_crc_length = 8;
 
 	int physical_buffer_size = 200'0000;
 
+	int max_view_length = 1 << 14;
+
 	std::chrono::system_clock::time_point start;
 
 	Logger logger;
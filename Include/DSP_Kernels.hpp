@@ -0,0 +1,319 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <span>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ATHERNET_DSP_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define ATHERNET_DSP_NEON 1
+#include <arm_neon.h>
+#endif
+
+// * MSVC emits AVX2 intrinsics without per-function target flags
+#if defined(ATHERNET_DSP_X86) && !defined(_MSC_VER)
+#define ATHERNET_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define ATHERNET_TARGET_AVX2
+#endif
+
+namespace Athernet {
+
+// Float kernels of the demodulator and the Viterbi decoder (and the GF(2) row XOR of the LT decoder),
+// all on contiguous spans.
+// Implementation is picked once at start up: AVX2 / NEON / scalar.
+class DSP_Kernels {
+	using DotFn = float (*)(const float*, const float*, int);
+	using EnergyFn = float (*)(const float*, int);
+	using PairSumsFn = void (*)(const float*, int, float*);
+	using XorFn = void (*)(uint64_t*, const uint64_t*, int);
+	using ViterbiFn = uint64_t (*)(const float*, float*, const float*, const float*, float, float);
+
+public:
+	// Singleton
+	static const DSP_Kernels& get_instance()
+	{
+		static DSP_Kernels instance;
+		return instance;
+	}
+
+	// sum x[i] * y[i]
+	float dot(std::span<const float> x, std::span<const float> y) const
+	{
+		assert(x.size() == y.size());
+		return m_dot(x.data(), y.data(), static_cast<int>(x.size()));
+	}
+
+	// sum x[i] * x[i]
+	float energy(std::span<const float> x) const { return m_energy(x.data(), static_cast<int>(x.size())); }
+
+	// result[k] = dot(x, carriers[k])
+	void multi_dot(std::span<const float> x, std::span<const float* const> carriers, std::span<float> result) const
+	{
+		assert(carriers.size() <= result.size());
+		for (size_t k = 0; k < carriers.size(); ++k) {
+			result[k] = m_dot(x.data(), carriers[k], static_cast<int>(x.size()));
+		}
+	}
+
+	// result[k] = x[2k] + x[2k + 1]
+	void pair_sums(std::span<const float> x, std::span<float> result) const
+	{
+		assert(result.size() * 2 <= x.size());
+		m_pair_sums(x.data(), static_cast<int>(result.size()), result.data());
+	}
+
+	// x[i] ^= y[i]
+	void xor_words(std::span<uint64_t> x, std::span<const uint64_t> y) const
+	{
+		assert(x.size() == y.size());
+		m_xor_words(x.data(), y.data(), static_cast<int>(x.size()));
+	}
+
+	// one trellis step of a 64 state Viterbi decoder, state n is reached from n / 2 and n / 2 + 32:
+	// next[n] = max(old[n / 2] + bm, old[n / 2 + 32] - bm) with bm = s0 * sign0[n] + s1 * sign1[n];
+	// bit n of the result is set where the second one wins
+	uint64_t viterbi_step(std::span<const float, 64> old, std::span<float, 64> next, std::span<const float, 64> sign0,
+		std::span<const float, 64> sign1, float s0, float s1) const
+	{
+		return m_viterbi_step(old.data(), next.data(), sign0.data(), sign1.data(), s0, s1);
+	}
+
+	const char* name() const { return m_name; }
+
+private:
+	DSP_Kernels()
+	{
+#if defined(ATHERNET_DSP_X86)
+		if (cpu_has_avx2()) {
+			m_dot = dot_avx2;
+			m_energy = energy_avx2;
+			m_pair_sums = pair_sums_avx2;
+			m_xor_words = xor_words_avx2;
+			m_viterbi_step = viterbi_step_avx2;
+			m_name = "AVX2";
+		}
+#elif defined(ATHERNET_DSP_NEON)
+		m_dot = dot_neon;
+		m_energy = energy_neon;
+		m_pair_sums = pair_sums_neon;
+		m_xor_words = xor_words_neon;
+		m_viterbi_step = viterbi_step_neon;
+		m_name = "NEON";
+#endif
+	}
+
+	// * ------------------------------ scalar ------------------------------ *
+
+	static float dot_scalar(const float* x, const float* y, int n)
+	{
+		float sum = 0;
+		for (int i = 0; i < n; ++i)
+			sum += x[i] * y[i];
+		return sum;
+	}
+
+	static float energy_scalar(const float* x, int n) { return dot_scalar(x, x, n); }
+
+	static void pair_sums_scalar(const float* x, int n, float* result)
+	{
+		for (int i = 0; i < n; ++i)
+			result[i] = x[2 * i] + x[2 * i + 1];
+	}
+
+	static void xor_words_scalar(uint64_t* x, const uint64_t* y, int n)
+	{
+		for (int i = 0; i < n; ++i)
+			x[i] ^= y[i];
+	}
+
+	static uint64_t viterbi_step_scalar(
+		const float* old, float* next, const float* sign0, const float* sign1, float s0, float s1)
+	{
+		uint64_t decisions = 0;
+		for (int n = 0; n < 64; ++n) {
+			float bm = s0 * sign0[n] + s1 * sign1[n];
+			float a = old[n >> 1] + bm;
+			float b = old[(n >> 1) + 32] - bm;
+			next[n] = b > a ? b : a;
+			decisions |= static_cast<uint64_t>(b > a) << n;
+		}
+		return decisions;
+	}
+
+	// * ------------------------------- AVX2 ------------------------------- *
+
+#if defined(ATHERNET_DSP_X86)
+	static bool cpu_has_avx2()
+	{
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+		__cpuid(info, 1);
+		bool fma = info[2] & (1 << 12);
+		bool osxsave = info[2] & (1 << 27);
+		bool avx = info[2] & (1 << 28);
+		// OS saves YMM state
+		if (!fma || !osxsave || !avx || (_xgetbv(0) & 6) != 6)
+			return false;
+		__cpuidex(info, 7, 0);
+		return info[1] & (1 << 5);
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+	}
+
+	ATHERNET_TARGET_AVX2 static float horizontal_sum_avx2(__m256 v)
+	{
+		__m128 x = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+		x = _mm_add_ss(x, _mm_movehdup_ps(x));
+		return _mm_cvtss_f32(x);
+	}
+
+	ATHERNET_TARGET_AVX2 static float dot_avx2(const float* x, const float* y, int n)
+	{
+		__m256 acc0 = _mm256_setzero_ps();
+		__m256 acc1 = _mm256_setzero_ps();
+		int i = 0;
+		for (; i + 16 <= n; i += 16) {
+			acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), acc0);
+			acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8), acc1);
+		}
+		for (; i + 8 <= n; i += 8) {
+			acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), acc0);
+		}
+		float sum = horizontal_sum_avx2(_mm256_add_ps(acc0, acc1));
+		for (; i < n; ++i)
+			sum += x[i] * y[i];
+		return sum;
+	}
+
+	ATHERNET_TARGET_AVX2 static float energy_avx2(const float* x, int n) { return dot_avx2(x, x, n); }
+
+	ATHERNET_TARGET_AVX2 static void pair_sums_avx2(const float* x, int n, float* result)
+	{
+		int i = 0;
+		for (; i + 8 <= n; i += 8) {
+			__m256 lo = _mm256_loadu_ps(x + 2 * i);
+			__m256 hi = _mm256_loadu_ps(x + 2 * i + 8);
+			// hadd works per 128-bit lane, fix the order afterwards
+			__m256 sums = _mm256_hadd_ps(lo, hi);
+			sums = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(sums), 0b11011000));
+			_mm256_storeu_ps(result + i, sums);
+		}
+		pair_sums_scalar(x + 2 * i, n - i, result + i);
+	}
+
+	ATHERNET_TARGET_AVX2 static void xor_words_avx2(uint64_t* x, const uint64_t* y, int n)
+	{
+		int i = 0;
+		for (; i + 4 <= n; i += 4) {
+			__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+			__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + i));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(x + i), _mm256_xor_si256(a, b));
+		}
+		xor_words_scalar(x + i, y + i, n - i);
+	}
+
+	ATHERNET_TARGET_AVX2 static uint64_t viterbi_step_avx2(
+		const float* old, float* next, const float* sign0, const float* sign1, float s0, float s1)
+	{
+		// 4 old metrics to 8 lanes, each twice
+		const __m256i spread = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+		const __m256 v0 = _mm256_set1_ps(s0);
+		const __m256 v1 = _mm256_set1_ps(s1);
+		uint64_t decisions = 0;
+		for (int n = 0; n < 64; n += 8) {
+			__m256 bm = _mm256_fmadd_ps(v0, _mm256_loadu_ps(sign0 + n), _mm256_mul_ps(v1, _mm256_loadu_ps(sign1 + n)));
+			__m256 a = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(_mm_loadu_ps(old + n / 2)), spread);
+			__m256 b = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(_mm_loadu_ps(old + n / 2 + 32)), spread);
+			a = _mm256_add_ps(a, bm);
+			b = _mm256_sub_ps(b, bm);
+			_mm256_storeu_ps(next + n, _mm256_max_ps(a, b));
+			decisions |= static_cast<uint64_t>(_mm256_movemask_ps(_mm256_cmp_ps(b, a, _CMP_GT_OQ))) << n;
+		}
+		return decisions;
+	}
+#endif
+
+	// * ------------------------------- NEON ------------------------------- *
+
+#if defined(ATHERNET_DSP_NEON)
+	static float dot_neon(const float* x, const float* y, int n)
+	{
+		float32x4_t acc0 = vdupq_n_f32(0);
+		float32x4_t acc1 = vdupq_n_f32(0);
+		int i = 0;
+		for (; i + 8 <= n; i += 8) {
+			acc0 = vfmaq_f32(acc0, vld1q_f32(x + i), vld1q_f32(y + i));
+			acc1 = vfmaq_f32(acc1, vld1q_f32(x + i + 4), vld1q_f32(y + i + 4));
+		}
+		float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+		for (; i < n; ++i)
+			sum += x[i] * y[i];
+		return sum;
+	}
+
+	static float energy_neon(const float* x, int n) { return dot_neon(x, x, n); }
+
+	static void pair_sums_neon(const float* x, int n, float* result)
+	{
+		int i = 0;
+		for (; i + 4 <= n; i += 4) {
+			vst1q_f32(result + i, vpaddq_f32(vld1q_f32(x + 2 * i), vld1q_f32(x + 2 * i + 4)));
+		}
+		pair_sums_scalar(x + 2 * i, n - i, result + i);
+	}
+
+	static void xor_words_neon(uint64_t* x, const uint64_t* y, int n)
+	{
+		int i = 0;
+		for (; i + 2 <= n; i += 2) {
+			vst1q_u64(x + i, veorq_u64(vld1q_u64(x + i), vld1q_u64(y + i)));
+		}
+		xor_words_scalar(x + i, y + i, n - i);
+	}
+
+	static uint64_t viterbi_step_neon(
+		const float* old, float* next, const float* sign0, const float* sign1, float s0, float s1)
+	{
+		static const uint32_t LANE_BITS[4] = { 1, 2, 4, 8 };
+		const uint32x4_t lane_bits = vld1q_u32(LANE_BITS);
+		uint64_t decisions = 0;
+		for (int n = 0; n < 64; n += 8) {
+			float32x4_t old_a = vld1q_f32(old + n / 2);
+			float32x4_t old_b = vld1q_f32(old + n / 2 + 32);
+			for (int half = 0; half < 2; ++half) {
+				const int m = n + 4 * half;
+				// 2 old metrics to 4 lanes, each twice
+				float32x4_t a = half ? vzip2q_f32(old_a, old_a) : vzip1q_f32(old_a, old_a);
+				float32x4_t b = half ? vzip2q_f32(old_b, old_b) : vzip1q_f32(old_b, old_b);
+				float32x4_t bm = vfmaq_n_f32(vmulq_n_f32(vld1q_f32(sign1 + m), s1), vld1q_f32(sign0 + m), s0);
+				a = vaddq_f32(a, bm);
+				b = vsubq_f32(b, bm);
+				vst1q_f32(next + m, vmaxq_f32(a, b));
+				decisions |= static_cast<uint64_t>(vaddvq_u32(vandq_u32(vcgtq_f32(b, a), lane_bits))) << m;
+			}
+		}
+		return decisions;
+	}
+#endif
+
+	DotFn m_dot = dot_scalar;
+	EnergyFn m_energy = energy_scalar;
+	PairSumsFn m_pair_sums = pair_sums_scalar;
+	XorFn m_xor_words = xor_words_scalar;
+	ViterbiFn m_viterbi_step = viterbi_step_scalar;
+	const char* m_name = "Scalar";
+};
+
+}
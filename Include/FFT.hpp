@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+namespace Athernet {
+
+// Iterative radix-2 FFT, size must be a power of 2.
+// Twiddles and bit-reversal permutation are pre-calculated once per size.
+class FFT {
+	using Complex = std::complex<double>;
+
+public:
+	FFT(int size)
+		: m_size { size }
+		, m_twiddles(size / 2)
+		, m_bit_reverse(size)
+	{
+		assert(size > 0 && (size & (size - 1)) == 0);
+
+		auto PI = acos(-1);
+		for (int i = 0; i < size / 2; ++i) {
+			m_twiddles[i] = std::polar(1.0, -2 * PI * i / size);
+		}
+
+		int log_size = 0;
+		while ((1 << log_size) < size)
+			++log_size;
+		for (int i = 0; i < size; ++i) {
+			int r = 0;
+			for (int j = 0; j < log_size; ++j) {
+				r |= ((i >> j) & 1) << (log_size - 1 - j);
+			}
+			m_bit_reverse[i] = r;
+		}
+	}
+
+	int size() const { return m_size; }
+
+	// * a * b without the inf / NaN recovery of operator* (C99 Annex G), which is a library call
+	// per product unless built with -ffast-math
+	static Complex mul(Complex a, Complex b)
+	{
+		return { a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real() };
+	}
+
+	void forward(std::vector<Complex>& data) const { transform(data, false); }
+
+	// * normalized by 1/N
+	void inverse(std::vector<Complex>& data) const
+	{
+		transform(data, true);
+		for (auto& x : data) {
+			x /= m_size;
+		}
+	}
+
+private:
+	void transform(std::vector<Complex>& data, bool inverse) const
+	{
+		assert(static_cast<int>(data.size()) == m_size);
+
+		for (int i = 0; i < m_size; ++i) {
+			if (i < m_bit_reverse[i])
+				std::swap(data[i], data[m_bit_reverse[i]]);
+		}
+
+		for (int len = 2; len <= m_size; len <<= 1) {
+			int half = len >> 1;
+			int stride = m_size / len;
+			for (int i = 0; i < m_size; i += len) {
+				for (int j = 0; j < half; ++j) {
+					Complex w = inverse ? std::conj(m_twiddles[j * stride]) : m_twiddles[j * stride];
+					Complex u = data[i + j];
+					Complex v = mul(data[i + j + half], w);
+					data[i + j] = u + v;
+					data[i + j + half] = u - v;
+				}
+			}
+		}
+	}
+
+	int m_size;
+	std::vector<Complex> m_twiddles;
+	std::vector<int> m_bit_reverse;
+};
+
+}
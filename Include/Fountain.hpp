@@ -0,0 +1,186 @@
+#pragma once
+
+#include "BitBuffer.hpp"
+#include "Config.hpp"
+#include "DSP_Kernels.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace Athernet {
+
+// Rateless code over num_source blocks, both ends derive everything from the block count.
+// Intermediate blocks are the source blocks followed by the precode parity blocks, parity j is the
+// XOR of the source blocks precode(j) lists (LDPC like, every source block in 3 parities).
+// Symbol id picks its intermediate blocks: a Robust Soliton degree, then that many distinct blocks.
+// In systematic mode symbols 0 .. num_source - 1 are the source blocks as they are, repair symbols
+// after them get a minimum degree.
+class FountainCode {
+public:
+	explicit FountainCode(int num_source)
+		: m_num_source { num_source }
+		, config { Config::get_instance() }
+	{
+		assert(num_source > 0);
+		m_num_parity = config.get_lt_precode_ratio() > 0
+			? std::max(3, static_cast<int>(ceil(num_source * config.get_lt_precode_ratio())))
+			: 0;
+		m_systematic = config.get_lt_systematic();
+		build_precode();
+		build_degree_distribution();
+	}
+
+	int num_source() const { return m_num_source; }
+	int num_parity() const { return m_num_parity; }
+	int num_intermediate() const { return m_num_source + m_num_parity; }
+
+	// source blocks of parity j, not including the parity block itself (num_source() + j)
+	const std::vector<int>& precode(int j) const { return m_precode[j]; }
+
+	// intermediate blocks XORed into symbol id
+	void neighbours(int id, std::vector<int>& out) const
+	{
+		out.clear();
+		if (m_systematic && id < m_num_source) {
+			out.push_back(id);
+			return;
+		}
+
+		std::minstd_rand random(mix(static_cast<uint32_t>(id)));
+		std::uniform_real_distribution<double> uniform;
+		int degree = static_cast<int>(std::upper_bound(std::begin(m_cdf), std::end(m_cdf), uniform(random)) - std::begin(m_cdf)) + 1;
+		// * the source symbols already cover most blocks, low degree repair symbols would rarely
+		// hit one that is missing
+		if (m_systematic)
+			degree = std::max(degree, config.get_lt_min_repair_degree());
+		degree = std::min(degree, num_intermediate());
+
+		std::uniform_int_distribution<int> pick(0, num_intermediate() - 1);
+		while (static_cast<int>(out.size()) < degree) {
+			int block = pick(random);
+			if (std::find(std::begin(out), std::end(out), block) == std::end(out))
+				out.push_back(block);
+		}
+	}
+
+private:
+	// ids are consecutive, spread them before seeding
+	static uint32_t mix(uint32_t x)
+	{
+		x ^= x >> 16;
+		x *= 0x7feb352d;
+		x ^= x >> 15;
+		x *= 0x846ca68b;
+		x ^= x >> 16;
+		// minstd_rand rejects 0
+		return x % 2147483646 + 1;
+	}
+
+	void build_precode()
+	{
+		m_precode.assign(m_num_parity, {});
+		if (!m_num_parity)
+			return;
+		const int s = m_num_parity;
+		for (int i = 0; i < m_num_source; ++i) {
+			int a = 1 + (i / s) % (s - 1);
+			int b = i % s;
+			for (int k = 0; k < 3; ++k) {
+				// 2a = s sends it back to the same parity, once is enough
+				if (m_precode[b].empty() || m_precode[b].back() != i)
+					m_precode[b].push_back(i);
+				b = (b + a) % s;
+			}
+		}
+	}
+
+	// Robust Soliton over the intermediate blocks
+	void build_degree_distribution()
+	{
+		const int k = num_intermediate();
+		const double c = config.get_lt_soliton_c();
+		const double delta = config.get_lt_soliton_delta();
+		const double r = std::max(1.0, c * log(k / delta) * sqrt(k));
+		const int spike = std::clamp(static_cast<int>(k / r), 1, k);
+
+		std::vector<double> mu(k + 1, 0.0);
+		for (int d = 1; d <= k; ++d) {
+			double rho = (d == 1) ? 1.0 / k : 1.0 / (static_cast<double>(d) * (d - 1));
+			double tau = 0;
+			if (d < spike) {
+				tau = r / (static_cast<double>(d) * k);
+			} else if (d == spike) {
+				tau = r * log(r / delta) / k;
+			}
+			mu[d] = rho + std::max(tau, 0.0);
+		}
+
+		m_cdf.resize(k);
+		double sum = 0;
+		for (int d = 1; d <= k; ++d) {
+			sum += mu[d];
+			m_cdf[d - 1] = sum;
+		}
+		for (auto& x : m_cdf)
+			x /= sum;
+		m_cdf.back() = 1.0;
+	}
+
+	int m_num_source;
+	int m_num_parity = 0;
+	bool m_systematic = true;
+	std::vector<std::vector<int>> m_precode;
+	// P(degree <= d + 1)
+	std::vector<double> m_cdf;
+
+	Config& config;
+};
+
+// Symbols of one file on demand, any number of them
+class FountainEncoder {
+public:
+	// blocks: the source blocks, all the same size
+	explicit FountainEncoder(std::vector<BitBuffer> blocks)
+		: m_code(static_cast<int>(blocks.size()))
+		, m_blocks { std::move(blocks) }
+	{
+		int block_bits = m_blocks[0].size();
+		for (int j = 0; j < m_code.num_parity(); ++j) {
+			BitBuffer parity(block_bits);
+			for (int i : m_code.precode(j))
+				xor_into(parity, m_blocks[i]);
+			m_blocks.push_back(std::move(parity));
+		}
+	}
+
+	const FountainCode& code() const { return m_code; }
+
+	int block_bits() const { return m_blocks[0].size(); }
+
+	// safe to call from several threads
+	BitBuffer symbol(int id) const
+	{
+		std::vector<int> neighbours;
+		m_code.neighbours(id, neighbours);
+		BitBuffer ret(block_bits());
+		for (int block : neighbours)
+			xor_into(ret, m_blocks[block]);
+		return ret;
+	}
+
+private:
+	static void xor_into(BitBuffer& x, const BitBuffer& y)
+	{
+		DSP_Kernels::get_instance().xor_words(
+			{ x.words(), static_cast<size_t>(x.num_words()) }, { y.words(), static_cast<size_t>(y.num_words()) });
+	}
+
+	FountainCode m_code;
+	// intermediate blocks
+	std::vector<BitBuffer> m_blocks;
+};
+
+}
@@ -108,6 +108,7 @@ public:
 	~IP_Layer()
 	{
 		athernet_running.store(false);
+		m_packets.shutdown();
 		athernet_thead.join();
 		if (wlan_on) {
 			wlan_dev->stopCapture();
@@ -512,16 +513,7 @@ public:
 		}
 	}
 
-	std::vector<int> bytes_to_bits(const std::vector<uint8_t>& bytes)
-	{
-		std::vector<int> bits;
-		for (auto x : bytes) {
-			for (int i = 0; i < 8; ++i) {
-				bits.push_back((x >> i) & 1);
-			}
-		}
-		return bits;
-	}
+	BitBuffer bytes_to_bits(const std::vector<uint8_t>& bytes) { return BitBuffer::from_bytes(bytes); }
 
 	Config& config;
 	SyncQueue<Bytes> m_packets;
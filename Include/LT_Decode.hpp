@@ -1,22 +1,43 @@
 #pragma once
 
+#include "BitBuffer.hpp"
 #include "Config.hpp"
+#include "Fountain.hpp"
+#include "LT_Solver.hpp"
 #include "SyncQueue.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
 namespace Athernet {
 
+// Frames are sorted by transfer and chunk on the decoder thread, the chunks themselves are decoded
+// on the ThreadPool: every chunk is a strand of its own (one task at a time, in arrival order),
+// different chunks and transfers go in parallel while audio is still coming in.
 class LT_Decode {
-	using Frame = std::vector<int>;
+	using Frame = BitBuffer;
 
 public:
 	LT_Decode(SyncQueue<Frame>& decoder_queue, SyncQueue<Frame>& recv_queue)
 		: m_decoder_queue { decoder_queue }
 		, m_recv_queue { recv_queue }
 		, config { Config::get_instance() }
+		, m_pool { ThreadPool::get_instance() }
 	{
 		decoder_running.store(true);
 		decoder_worker = std::thread(&LT_Decode::decode, this);
@@ -25,134 +46,352 @@ public:
 	~LT_Decode()
 	{
 		decoder_running.store(false);
+		m_decoder_queue.shutdown();
 		decoder_worker.join();
+		// pool tasks still hold on to this
+		std::unique_lock lock { m_mutex };
+		m_idle.wait(lock, [this] { return !m_tasks; });
 	}
 
+	// decoded files are written straight to path instead of being pushed to recv_queue, empty to undo;
+	// applies to transfers starting after the call
+	void set_output_file(std::string path)
+	{
+		std::scoped_lock lock { m_mutex };
+		m_output_path = std::move(path);
+	}
+
+	// called on a pool thread for every chunk decoded, last once the whole file is there;
+	// e.g. to tell the sender to move on
+	void set_on_complete(std::function<void(int, bool)> callback)
+	{
+		std::scoped_lock lock { m_mutex };
+		m_on_complete = std::move(callback);
+	}
+
+	// transfer, chunk, whole file: what the sender has to hear about, for every chunk decoded (on a
+	// pool thread) and again for every frame of it that still comes in (on the decoder thread)
+	void set_on_report(std::function<void(int, int, bool)> callback)
+	{
+		std::scoped_lock lock { m_mutex };
+		m_on_report = std::move(callback);
+	}
+
+	// coded frame: block count | symbol id | chunk | transfer | symbol
+	// a file is [64 bit length in bits][data], chunk c starts at c * get_lt_num_blocks() symbols
 	void decode()
 	{
+		const int count_bits = config.get_lt_block_count_bits();
+		const int id_bits = config.get_lt_symbol_id_bits();
+		const int chunk_bits = config.get_lt_chunk_bits();
+		const int transfer_bits = config.get_lt_transfer_bits();
+		const int overhead = config.get_phy_coding_overhead();
+
 		Frame frame;
-		std::vector<int> G[100];
-		std::vector<int> Y[100];
-		int num_ones[100];
-		int empty_rows = 100;
-		int group_flag = -1;
-		int got = 0;
 		while (decoder_running.load()) {
 			if (!m_decoder_queue.pop(frame)) {
-				std::this_thread::yield();
 				continue;
 			}
-			if (group_flag == -1) {
-				group_flag = 0;
-				for (int i = 0; i < 100; ++i) {
-					G[i] = std::vector<int>(100);
-					Y[i] = std::vector<int>(frame.size() - 1 - config.get_phy_coding_overhead());
+			if (frame.size() <= overhead)
+				continue;
+
+			int num_source = static_cast<int>(frame.extract(0, count_bits));
+			int id = static_cast<int>(frame.extract(count_bits, id_bits));
+			int index = static_cast<int>(frame.extract(count_bits + id_bits, chunk_bits));
+			int transfer_id = static_cast<int>(frame.extract(count_bits + id_bits + chunk_bits, transfer_bits));
+			int block_bits = frame.size() - overhead;
+			if (!num_source)
+				continue;
+
+			// * late frames of a transfer that is done already
+			std::erase_if(m_transfers, [&](const auto& item) {
+				const auto& done = *item.second;
+				if (!done.finished.load())
+					return false;
+				m_finished.push_back({ item.first, done.block_bits, done.length });
+				if (m_finished.size() > 16)
+					m_finished.pop_front();
+				return true;
+			});
+			auto finished = std::find_if(std::begin(m_finished), std::end(m_finished),
+				[&](const Finished& item) { return item.id == transfer_id; });
+			if (finished != std::end(m_finished)) {
+				if (finished->has(index, num_source, block_bits, config.get_lt_num_blocks())) {
+					report(transfer_id, index, true);
+					continue;
 				}
-				memset(num_ones, 0, sizeof(num_ones));
-				empty_rows = 100;
+				// * the id again, but a file of another shape: a restarted sender
+				m_finished.erase(finished);
 			}
 
-			if (frame[frame.size() - 1] != group_flag)
-				continue;
+			auto& transfer = m_transfers[transfer_id];
+			if (!transfer) {
+				transfer = std::make_shared<Transfer>();
+				transfer->id = transfer_id;
+				std::scoped_lock lock { m_mutex };
+				transfer->path = m_output_path;
+			}
 
-			if (!empty_rows)
+			std::shared_ptr<Chunk> chunk;
+			bool last = false;
+			{
+				std::scoped_lock lock { transfer->mutex };
+				if (transfer->is_decoded(index)) {
+					last = transfer->complete();
+				} else {
+					// * a different block count or size can only be a different file
+					auto& slot = transfer->chunks[index];
+					if (!slot || num_source != slot->code.num_source() || block_bits != slot->solver.block_bits())
+						slot = std::make_shared<Chunk>(index, num_source, block_bits);
+					chunk = slot;
+				}
+			}
+			// * decoded already, the sender didn't hear
+			if (!chunk) {
+				report(transfer_id, index, last);
 				continue;
+			}
 
-			++got;
-			frame.pop_back();
-
-			int start_point = 0;
-			for (int i = 0; i < 7; ++i) {
-				if (frame[i])
-					start_point += (1 << i);
+			bool schedule = false;
+			{
+				std::scoped_lock lock { chunk->mutex };
+				chunk->inbox.emplace_back(id, frame.slice(overhead, frame.size()));
+				schedule = !std::exchange(chunk->scheduled, true);
 			}
-			int bit_map_start = 7;
-			std::vector<int> new_eq(100);
-			new_eq[start_point] = 1;
-			for (int i = 0; i < 19; ++i) {
-				int j = (start_point + i + 1);
-				if (j >= 100)
-					j -= 100;
-				new_eq[j] = frame[bit_map_start + i];
+			if (schedule) {
+				{
+					std::scoped_lock lock { m_mutex };
+					++m_tasks;
+				}
+				m_pool.submit([this, transfer, chunk] {
+					drain(*transfer, *chunk);
+					// * notified under the lock: the destructor can't return (and take m_idle with it) before
+					std::scoped_lock lock { m_mutex };
+					if (!--m_tasks)
+						m_idle.notify_all();
+				});
 			}
+		}
+	}
 
-			int s = 0;
-			while (!new_eq[s]) {
-				++s;
+private:
+	struct Chunk {
+		Chunk(int index, int num_source, int block_bits)
+			: index { index }
+			, code(num_source)
+			, solver(code.num_intermediate(), block_bits)
+		{
+			// precode: every parity block XOR its source blocks is zero
+			std::vector<int> neighbours;
+			for (int j = 0; j < code.num_parity(); ++j) {
+				neighbours = code.precode(j);
+				neighbours.push_back(num_source + j);
+				solver.add(neighbours, BitBuffer(block_bits));
 			}
+		}
 
-			int eq_ones = 0;
-			for (int i = s; i < 100; ++i)
-				eq_ones += new_eq[i];
+		int index;
+		FountainCode code;
+		// pool task only
+		LT_Solver solver;
 
-			std::vector<int> new_y;
-			int packet_start = config.get_phy_coding_overhead();
-			std::copy(std::begin(frame) + packet_start, std::end(frame), std::back_inserter(new_y));
+		std::mutex mutex;
+		// symbol id, symbol
+		std::vector<std::pair<int, BitBuffer>> inbox;
+		bool scheduled = false;
+	};
 
-			while (eq_ones > 0 && G[s][s]) {
-				if (eq_ones >= num_ones[s]) {
-					for (int i = 0; i < new_y.size(); ++i)
-						new_y[i] ^= Y[s][i];
-					for (int i = s; i < new_eq.size(); ++i)
-						new_eq[i] ^= G[s][i];
-				} else {
-					std::swap(new_eq, G[s]);
-					std::swap(new_y, Y[s]);
-					num_ones[s] = eq_ones;
+	// what we have of one file, decoded data only; guarded by mutex
+	struct Transfer {
+		bool is_decoded(int index) const { return index < static_cast<int>(decoded.size()) && decoded[index]; }
+
+		bool complete() const { return length >= 0 && num_decoded == num_chunks; }
+
+		int id = 0;
+		std::mutex mutex;
+		std::map<int, std::shared_ptr<Chunk>> chunks;
+
+		// bits, -1 until chunk 0 is in
+		int64_t length = -1;
+		int block_bits = 0;
+		int num_chunks = 0;
+		int num_decoded = 0;
+		int64_t symbols = 0;
+		int64_t source_blocks = 0;
+		std::vector<char> decoded;
+
+		// to recv_queue
+		BitBuffer data;
+		// or to a file
+		std::string path;
+		std::fstream out;
+
+		std::atomic_bool finished = false;
+	};
+
+	// what is left of a finished transfer, enough to tell its late frames from a new file's
+	struct Finished {
+		// * a frame of this file would have chunk index with num_source blocks of block_bits, as
+		// LT_Send_Stream cuts them
+		bool has(int index, int num_source, int frame_block_bits, int num_blocks) const
+		{
+			if (frame_block_bits != block_bits)
+				return false;
+			const int64_t total = 64 + length;
+			const int64_t begin = static_cast<int64_t>(index) * num_blocks * block_bits;
+			return begin < total
+				&& num_source == std::min<int64_t>(num_blocks, (total - begin + block_bits - 1) / block_bits);
+		}
+
+		int id;
+		int block_bits;
+		int64_t length;
+	};
+
+	// pool task: everything queued for the chunk so far
+	void drain(Transfer& transfer, Chunk& chunk)
+	{
+		std::vector<std::pair<int, BitBuffer>> symbols;
+		std::vector<int> neighbours;
+		while (true) {
+			{
+				std::scoped_lock lock { chunk.mutex };
+				if (chunk.inbox.empty()) {
+					chunk.scheduled = false;
+					return;
 				}
-				while (s < new_eq.size() && !new_eq[s])
-					++s;
-				eq_ones = 0;
-				for (int i = s; i < new_eq.size(); ++i)
-					eq_ones += new_eq[i];
+				std::swap(symbols, chunk.inbox);
 			}
+			bool was_complete = chunk.solver.complete();
+			for (auto& [id, symbol] : symbols) {
+				if (chunk.solver.complete())
+					break;
+				chunk.code.neighbours(id, neighbours);
+				chunk.solver.add(neighbours, std::move(symbol));
+			}
+			symbols.clear();
+			if (!was_complete && chunk.solver.complete())
+				store(transfer, chunk);
+		}
+	}
+
+	// data of a decoded chunk to where it belongs
+	void store(Transfer& transfer, const Chunk& chunk)
+	{
+		const int index = chunk.index;
+		const int num_source = chunk.code.num_source();
+		const int block_bits = chunk.solver.block_bits();
+		const int64_t chunk_total = static_cast<int64_t>(config.get_lt_num_blocks()) * block_bits;
+		const int64_t offset = index * chunk_total;
+		BitBuffer bits;
+		bits.reserve(num_source * block_bits);
+		for (int i = 0; i < num_source; ++i)
+			bits.append(chunk.solver.block(i));
 
-			if (eq_ones > 0) {
-				G[s] = std::move(new_eq);
-				Y[s] = std::move(new_y);
-				num_ones[s] = eq_ones;
-				--empty_rows;
+		bool last = false;
+		{
+			std::scoped_lock lock { transfer.mutex };
+			if (transfer.is_decoded(index))
+				return;
+			if (transfer.path.size() && !transfer.out.is_open()) {
+				transfer.out.open(transfer.path, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+				if (!transfer.out)
+					std::cerr << "Unable to open " << transfer.path << "!\n";
 			}
-			std::cerr << "\r     \r" << empty_rows;
-			if (!empty_rows) {
-				for (int pivot = 99; pivot > 0; --pivot) {
-					for (int row = pivot - 1; row >= 0; --row) {
-						if (G[row][pivot]) {
-							for (int i = 0; i < Y[0].size(); ++i)
-								Y[row][i] ^= Y[pivot][i];
-							for (int i = 0; i <= pivot; ++i)
-								G[row][i] ^= G[pivot][i];
-						}
-					}
-				}
 
-				std::vector<int> huge_frame;
-				for (int i = 0; i < 100; ++i)
-					std::copy(std::begin(Y[i]), std::end(Y[i]), std::back_inserter(huge_frame));
-				m_recv_queue.push(std::move(huge_frame));
+			// the length prefix
+			int skip = 0;
+			if (index == 0) {
+				transfer.length = static_cast<int64_t>(bits.extract(0, 64));
+				transfer.block_bits = block_bits;
+				transfer.num_chunks = static_cast<int>((64 + transfer.length + chunk_total - 1) / chunk_total);
+				skip = 64;
+			}
 
-				int length = 0;
-				for (int i = 0; i < 16; ++i) {
-					length += (Y[0][i] << i);
-				}
-				std::cerr << "\n";
-				std::cerr << "------------------------------------------------------------\n";
-				std::cerr << "Decoding complete.\n";
-				std::cerr << "Length: " << length << "\n";
-				std::cerr << got << " packets used.\n";
-				std::cerr << "------------------------------------------------------------\n";
-				got = 0;
+			if (transfer.path.size()) {
+				// binary files are sent in whole bytes
+				auto bytes = bits.slice(skip, bits.size()).to_bytes();
+				transfer.out.seekp((offset + skip - 64) / 8);
+				transfer.out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+			} else {
+				if (transfer.data.size() < offset + bits.size())
+					transfer.data.resize(static_cast<int>(offset + bits.size()));
+				transfer.data.xor_with(bits, static_cast<int>(offset));
 			}
+
+			if (index >= static_cast<int>(transfer.decoded.size()))
+				transfer.decoded.resize(index + 1);
+			transfer.decoded[index] = 1;
+			transfer.chunks.erase(index);
+			++transfer.num_decoded;
+			transfer.symbols += chunk.solver.num_received() - chunk.code.num_parity();
+			transfer.source_blocks += num_source;
+			std::cerr << "\r                \r" << transfer.num_decoded << " / " << transfer.num_chunks;
+
+			last = transfer.complete();
+			if (last)
+				finish(transfer);
+		}
+
+		{
+			std::scoped_lock lock { m_mutex };
+			if (m_on_complete)
+				m_on_complete(index, last);
 		}
+		report(transfer.id, index, last);
+	}
+
+	void report(int transfer, int chunk, bool last)
+	{
+		std::scoped_lock lock { m_mutex };
+		if (m_on_report)
+			m_on_report(transfer, chunk, last);
+	}
+
+	// transfer.mutex held
+	void finish(Transfer& transfer)
+	{
+		if (transfer.path.size()) {
+			transfer.out.close();
+			std::error_code error;
+			std::filesystem::resize_file(transfer.path, (transfer.length + 7) / 8, error);
+		} else {
+			m_recv_queue.push(transfer.data.slice(64, static_cast<int>(64 + transfer.length)));
+		}
+
+		std::cerr << "\n";
+		std::cerr << "------------------------------------------------------------\n";
+		std::cerr << "Decoding complete.\n";
+		std::cerr << "Length: " << transfer.length << "\n";
+		std::cerr << std::format("{} chunks, {} packets used, overhead {:.3f}.\n", transfer.num_chunks,
+			transfer.symbols, static_cast<double>(transfer.symbols) / transfer.source_blocks);
+		std::cerr << "------------------------------------------------------------\n";
+
+		transfer.data.clear();
+		transfer.chunks.clear();
+		transfer.finished.store(true);
 	}
 
-private:
 	std::atomic_bool decoder_running;
 	std::thread decoder_worker;
 
 	SyncQueue<Frame>& m_decoder_queue;
 	SyncQueue<Frame>& m_recv_queue;
 	Config& config;
+	ThreadPool& m_pool;
+
+	// decoder thread only
+	std::map<int, std::shared_ptr<Transfer>> m_transfers;
+	// recently finished transfers
+	std::deque<Finished> m_finished;
+
+	std::mutex m_mutex;
+	// pool tasks in flight
+	int m_tasks = 0;
+	std::condition_variable m_idle;
+	std::string m_output_path;
+	std::function<void(int, bool)> m_on_complete;
+	std::function<void(int, int, bool)> m_on_report;
 };
 
 }
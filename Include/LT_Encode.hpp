@@ -1,118 +1,206 @@
 #pragma once
 
+#include "BitBuffer.hpp"
 #include "Config.hpp"
+#include "Fountain.hpp"
+#include "MappedFile.hpp"
 #include "PHY_Layer.hpp"
-#include <mutex>
+#include "ThreadPool.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
 #include <random>
+#include <thread>
 #include <vector>
 
 namespace Athernet {
 
-template <typename T> void LT_Send(PHY_Layer<T>* physical_layer, std::string file)
+// num_bits of the data starting at pos, zero past the end
+using LT_Reader = std::function<BitBuffer(int64_t pos, int num_bits)>;
+
+// Fountain coded transfer of [64 bit length][data], in chunks of get_lt_num_blocks() source blocks.
+// get_lt_parallel_chunks() chunks are in flight at once, their frames interleaved so the receiver
+// can decode them in parallel; reading / precoding the next chunks and generating symbols run on
+// the ThreadPool. Memory holds the chunks in flight only, not the file.
+// Symbols of a chunk are generated on demand and sent until done(transfer, chunk) says the receiver
+// has it: PHY_Layer::lt_decoded over the link, or see LT_Decode::set_on_complete. Without done()
+// get_lt_blind_overhead() symbols per block are sent.
+// Frame: block count | symbol id | chunk | transfer | symbol | coded flag
+template <typename T>
+void LT_Send_Stream(PHY_Layer<T>* physical_layer, int64_t num_bits, const LT_Reader& read, std::function<bool(int, int)> done = {})
 {
-	static int group_flag = 0;
-	static std::mutex mutex;
-
-	std::scoped_lock lock { mutex };
-
-	group_flag ^= 1;
-	std::vector<int> text;
-	int c;
-
-	file = NOTEBOOK_DIR + file;
-	auto fd = fopen(file.c_str(), "r");
-	if (!fd) {
-		std::cerr << "File not found!\n";
+	using namespace std::chrono_literals;
+
+	// tells transfers apart on the other side, several may run at once; a random start so a restarted
+	// sender hardly ever reuses an id the receiver remembers as finished (and if it does, the receiver
+	// still tells the files apart by their shape, see LT_Decode::Finished)
+	static std::atomic_int next_transfer = static_cast<int>(std::random_device {}());
+
+	auto& config = Config::get_instance();
+	auto& pool = ThreadPool::get_instance();
+	const int transfer = next_transfer.fetch_add(1) & ((1 << config.get_lt_transfer_bits()) - 1);
+
+	const int64_t total = 64 + num_bits;
+	const int num_blocks = config.get_lt_num_blocks();
+
+	// whatever is left of a frame (at the code rate set now) after the coding header and flags, in whole bytes
+	const int max_symbol_bits = (physical_layer->max_frame_bits() - config.get_phy_coding_overhead() - 1) / 8 * 8;
+	int64_t symbol_bits = config.get_lt_symbol_bits();
+	if (!symbol_bits)
+		symbol_bits = (total + num_blocks - 1) / num_blocks;
+	// * the length prefix has to fit in the first symbol, bytes keep files aligned on the other side
+	symbol_bits = std::clamp<int64_t>((symbol_bits + 7) / 8 * 8, 64, max_symbol_bits);
+	const int64_t chunk_total = num_blocks * symbol_bits;
+	const int num_chunks = static_cast<int>((total + chunk_total - 1) / chunk_total);
+	if (num_chunks > (1LL << config.get_lt_chunk_bits())) {
+		std::cerr << "File too large!\n";
 		return;
 	}
-	while ((c = fgetc(fd)) != EOF) {
-		text.push_back(int(c - '0'));
-	}
-	fclose(fd);
 
-	int file_len = (int)text.size();
-	std::vector<int> length;
-	for (int i = 0; i < 16; ++i) {
-		if (file_len & (1 << i)) {
-			length.push_back(1);
-		} else {
-			length.push_back(0);
+	// source blocks of chunk, read + precode
+	auto prepare = [&](int chunk) {
+		const int64_t begin = chunk * chunk_total;
+		const int num_source = static_cast<int>(std::min<int64_t>(num_blocks, (total - begin + symbol_bits - 1) / symbol_bits));
+		std::vector<BitBuffer> blocks;
+		for (int i = 0; i < num_source; ++i) {
+			// stream position -> length prefix or data
+			int64_t pos = begin + i * symbol_bits;
+			BitBuffer block;
+			block.reserve(static_cast<int>(symbol_bits));
+			if (pos < 64) {
+				block.append(static_cast<uint64_t>(num_bits), 64);
+				block.append(read(0, static_cast<int>(symbol_bits - 64)));
+			} else {
+				block = read(pos - 64, static_cast<int>(symbol_bits));
+			}
+			block.resize(static_cast<int>(symbol_bits));
+			blocks.push_back(std::move(block));
+		}
+		return std::make_unique<FountainEncoder>(std::move(blocks));
+	};
+
+	struct InFlight {
+		InFlight(int chunk, std::future<std::unique_ptr<FountainEncoder>> preparing)
+			: chunk { chunk }
+			, preparing { std::move(preparing) }
+		{
 		}
-	}
 
-	int num_packets = 100;
-	int packet_len = (int)(text.size() + length.size() - 1) / num_packets + 1;
+		int chunk;
+		std::future<std::unique_ptr<FountainEncoder>> preparing;
+		std::unique_ptr<FountainEncoder> encoder;
+		int next_id = 0;
+		int budget = 0;
+	};
+	std::vector<InFlight> in_flight;
+	int next_chunk = 0;
+	auto start_next = [&] {
+		if (next_chunk < num_chunks) {
+			int chunk = next_chunk++;
+			in_flight.emplace_back(chunk, pool.async([&, chunk] { return prepare(chunk); }));
+		}
+	};
+	for (int i = 0; i < config.get_lt_parallel_chunks(); ++i)
+		start_next();
+
+	const int id_limit = 1 << config.get_lt_symbol_id_bits();
+	std::vector<std::future<BitBuffer>> symbols;
+	while (in_flight.size()) {
+		// one symbol of every chunk in flight per round
+		symbols.clear();
+		for (auto& slot : in_flight) {
+			if (!slot.encoder) {
+				slot.encoder = slot.preparing.get();
+				int num_source = slot.encoder->code().num_source();
+				slot.budget = done ? id_limit : static_cast<int>(ceil(num_source * config.get_lt_blind_overhead()));
+			}
+			const FountainEncoder* encoder = slot.encoder.get();
+			int id = slot.next_id;
+			symbols.push_back(pool.async([encoder, id] { return encoder->symbol(id); }));
+		}
 
-	std::random_device seeder;
-	const auto seed = seeder.entropy() ? seeder() : time(nullptr);
-	std::mt19937 engine { static_cast<std::mt19937::result_type>(seed) };
-	std::uniform_int_distribution<int> window_start_distribution { 0, num_packets - 1 };
-	std::uniform_int_distribution<int> is_one_distribution { 1, 100 };
+		for (size_t i = 0; i < in_flight.size(); ++i) {
+			auto& slot = in_flight[i];
+			BitBuffer symbol = symbols[i].get();
+			// only a couple of frames ahead of the MAC, so we stop soon after done()
+			while (physical_layer->queued_frames() >= 2 && !(done && done(transfer, slot.chunk)))
+				std::this_thread::sleep_for(1ms);
+			if (done && done(transfer, slot.chunk)) {
+				slot.budget = 0;
+				continue;
+			}
 
-	std::vector<std::vector<int>> mat;
-	std::vector<int> a;
+			BitBuffer frame;
+			frame.append(slot.encoder->code().num_source(), config.get_lt_block_count_bits());
+			frame.append(slot.next_id++, config.get_lt_symbol_id_bits());
+			frame.append(slot.chunk, config.get_lt_chunk_bits());
+			frame.append(transfer, config.get_lt_transfer_bits());
+			frame.append(symbol);
+			// coded
+			frame.push_back(1);
 
-	for (auto x : length) {
-		a.push_back(x);
-		if (a.size() == packet_len) {
-			mat.push_back(std::move(a));
-			a.clear();
-		}
-	}
-	for (auto x : text) {
-		a.push_back(x);
-		if (a.size() == packet_len) {
-			mat.push_back(std::move(a));
-			a.clear();
+			physical_layer->send_frame(frame);
 		}
+
+		// retire finished chunks, the next ones take their place
+		int retired = 0;
+		std::erase_if(in_flight, [&](const InFlight& slot) {
+			bool finished = slot.encoder && slot.next_id >= slot.budget;
+			retired += finished;
+			return finished;
+		});
+		for (int i = 0; i < retired; ++i)
+			start_next();
 	}
+}
 
-	if (a.size()) {
-		for (int i = (int)a.size(); i < packet_len; ++i) {
-			a.push_back(0);
-		}
-		mat.push_back(std::move(a));
+// text file in NOTEBOOK_DIR, one '0' / '1' character per bit
+template <typename T> void LT_Send(PHY_Layer<T>* physical_layer, std::string file, std::function<bool(int, int)> done = {})
+{
+	file = NOTEBOOK_DIR + file;
+	auto fd = fopen(file.c_str(), "r");
+	if (!fd) {
+		std::cerr << "File not found!\n";
+		return;
+	}
+	BitBuffer data;
+	int c;
+	while ((c = fgetc(fd)) != EOF) {
+		data.push_back(c - '0');
 	}
+	fclose(fd);
 
-	double packet_fail_rate = 0.75;
-	int packets_to_send = static_cast<int>((num_packets + 25) / packet_fail_rate);
+	LT_Send_Stream(
+		physical_layer, data.size(),
+		[&](int64_t pos, int num_bits) {
+			int begin = static_cast<int>(std::min<int64_t>(pos, data.size()));
+			return data.slice(begin, std::min(begin + num_bits, data.size()));
+		},
+		std::move(done));
+}
 
-	while (packets_to_send--) {
-		std::vector<int> start;
-		int start_point = window_start_distribution(engine);
-		for (int i = 0; i < 7; ++i) {
-			if (start_point & (1 << i)) {
-				start.push_back(1);
-			} else {
-				start.push_back(0);
-			}
-		}
-		std::vector<int> bit_map(19);
-		std::vector<int> frame = mat[start_point];
-		for (int i = 0; i < 19; ++i) {
-			bit_map[i] = (is_one_distribution(engine) < 60) ? 1 : 0;
-			if (bit_map[i]) {
-				int j = start_point + i + 1;
-				if (j >= 100)
-					j -= 100;
-				for (int k = 0; k < packet_len; ++k) {
-					frame[k] ^= mat[j][k];
-				}
-			}
-		}
-		std::vector<int> actual_frame;
-		for (auto x : start)
-			actual_frame.push_back(x);
-		for (auto x : bit_map)
-			actual_frame.push_back(x);
-		for (auto x : frame)
-			actual_frame.push_back(x);
-
-		actual_frame.push_back(1);
-		actual_frame.push_back(1);
-
-		physical_layer->send_frame(actual_frame);
+// any file, memory mapped and sent byte for byte; the receiver writes it out with LT_Decode::set_output_file
+template <typename T> void LT_Send_File(PHY_Layer<T>* physical_layer, const std::string& path, std::function<bool(int, int)> done = {})
+{
+	MappedFile file(path);
+	if (!file.valid()) {
+		std::cerr << "File not found!\n";
+		return;
 	}
+	auto bytes = file.bytes();
+
+	LT_Send_Stream(
+		physical_layer, static_cast<int64_t>(bytes.size()) * 8,
+		[&](int64_t pos, int num_bits) {
+			// symbols are whole bytes
+			size_t begin = std::min(static_cast<size_t>(pos / 8), bytes.size());
+			size_t end = std::min(begin + (num_bits + 7) / 8, bytes.size());
+			return BitBuffer::from_bytes(bytes.subspan(begin, end - begin));
+		},
+		std::move(done));
 }
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+#include "BitBuffer.hpp"
+#include "DSP_Kernels.hpp"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <span>
+#include <vector>
+
+namespace Athernet {
+
+// Incremental LT decoder over GF(2).
+// Every received symbol is the XOR of a set of source blocks. It is first reduced by the blocks
+// already known and peeled straight away if a single unknown block is left.
+// Only the rest goes through Gaussian elimination, kept incrementally in echelon form: rows over
+// the unknown blocks, at most one per pivot (lowest set column). A block that becomes known is
+// cleared from every row, rows left with their pivot alone are peeled in turn, so the last symbol
+// that brings the rank up to the number of blocks resolves everything without a back substitution.
+// Coefficients and payloads are packed 64-bit words, XOR runs through DSP_Kernels.
+class LT_Solver {
+public:
+	LT_Solver() = default;
+
+	LT_Solver(int num_blocks, int block_bits) { reset(num_blocks, block_bits); }
+
+	void reset(int num_blocks, int block_bits)
+	{
+		m_num_blocks = num_blocks;
+		m_block_bits = block_bits;
+		m_blocks.assign(num_blocks, BitBuffer());
+		m_known.assign(num_blocks, 0);
+		m_rows.assign(num_blocks, Row());
+		m_pivots.clear();
+		m_num_known = 0;
+		m_num_received = 0;
+	}
+
+	// neighbours: source blocks XORed into payload, duplicates cancel out
+	// true once every block is known
+	bool add(std::span<const int> neighbours, BitBuffer payload)
+	{
+		assert(payload.size() == m_block_bits);
+		++m_num_received;
+		if (complete())
+			return true;
+
+		m_unknown.clear();
+		for (int block : neighbours) {
+			assert(block >= 0 && block < m_num_blocks);
+			if (m_known[block]) {
+				xor_into(payload, m_blocks[block]);
+			} else {
+				m_unknown.push_back(block);
+			}
+		}
+		std::sort(std::begin(m_unknown), std::end(m_unknown));
+		m_unknown.erase(cancel_pairs(m_unknown), std::end(m_unknown));
+
+		if (m_unknown.size() == 1) {
+			m_ripple.emplace_back(m_unknown[0], std::move(payload));
+		} else if (m_unknown.size() > 1) {
+			Row row { BitBuffer(m_num_blocks), std::move(payload) };
+			for (int block : m_unknown)
+				row.coefficients.set(block, 1);
+			insert(std::move(row));
+		}
+		peel();
+		return complete();
+	}
+
+	bool complete() const { return m_num_known == m_num_blocks; }
+
+	int num_blocks() const { return m_num_blocks; }
+	int block_bits() const { return m_block_bits; }
+	int num_known() const { return m_num_known; }
+	int num_received() const { return m_num_received; }
+	// independent symbols still waiting for more
+	int rank() const { return static_cast<int>(m_pivots.size()); }
+
+	bool is_known(int block) const { return m_known[block]; }
+	const BitBuffer& block(int i) const { return m_blocks[i]; }
+
+	// all blocks back to back
+	BitBuffer concatenate() const
+	{
+		BitBuffer ret;
+		ret.reserve(m_num_blocks * m_block_bits);
+		for (const auto& block : m_blocks)
+			ret.append(block);
+		return ret;
+	}
+
+private:
+	struct Row {
+		// one bit per block, only unknown blocks are set
+		BitBuffer coefficients;
+		BitBuffer payload;
+	};
+
+	static void xor_into(BitBuffer& x, const BitBuffer& y)
+	{
+		DSP_Kernels::get_instance().xor_words(
+			{ x.words(), static_cast<size_t>(x.num_words()) }, { y.words(), static_cast<size_t>(y.num_words()) });
+	}
+
+	// first set bit at or after from, size() if none
+	static int next_set(const BitBuffer& x, int from)
+	{
+		int word = from >> 6;
+		if (word >= x.num_words())
+			return x.size();
+		uint64_t bits = x.words()[word] & (~0ULL << (from & 63));
+		while (!bits) {
+			if (++word == x.num_words())
+				return x.size();
+			bits = x.words()[word];
+		}
+		return (word << 6) + std::countr_zero(bits);
+	}
+
+	// x ^ x = 0: drop pairs of equal (sorted) entries
+	static std::vector<int>::iterator cancel_pairs(std::vector<int>& sorted)
+	{
+		auto out = std::begin(sorted);
+		for (auto it = std::begin(sorted); it != std::end(sorted);) {
+			if (it + 1 != std::end(sorted) && *it == *(it + 1)) {
+				it += 2;
+			} else {
+				*out++ = *it++;
+			}
+		}
+		return out;
+	}
+
+	// forward elimination against the rows we have, new pivot or a peeled block
+	void insert(Row row)
+	{
+		int pivot = next_set(row.coefficients, 0);
+		while (pivot < m_num_blocks && !m_rows[pivot].coefficients.empty()) {
+			xor_into(row.coefficients, m_rows[pivot].coefficients);
+			xor_into(row.payload, m_rows[pivot].payload);
+			pivot = next_set(row.coefficients, pivot + 1);
+		}
+		if (pivot == m_num_blocks)
+			return;
+		if (next_set(row.coefficients, pivot + 1) == m_num_blocks) {
+			m_ripple.emplace_back(pivot, std::move(row.payload));
+			return;
+		}
+		m_rows[pivot] = std::move(row);
+		m_pivots.push_back(pivot);
+	}
+
+	// resolve everything on the ripple, substituting each block into the rows
+	void peel()
+	{
+		while (m_ripple.size()) {
+			auto [block, value] = std::move(m_ripple.back());
+			m_ripple.pop_back();
+			if (m_known[block])
+				continue;
+			m_known[block] = 1;
+			m_blocks[block] = std::move(value);
+			++m_num_known;
+
+			// its own row loses the pivot, goes back through elimination
+			Row own;
+			if (!m_rows[block].coefficients.empty()) {
+				own = std::move(m_rows[block]);
+				m_rows[block] = Row();
+				m_pivots.erase(std::find(std::begin(m_pivots), std::end(m_pivots), block));
+			}
+
+			for (size_t i = 0; i < m_pivots.size();) {
+				int pivot = m_pivots[i];
+				auto& row = m_rows[pivot];
+				if (row.coefficients[block]) {
+					row.coefficients.set(block, 0);
+					xor_into(row.payload, m_blocks[block]);
+					if (next_set(row.coefficients, pivot + 1) == m_num_blocks) {
+						m_ripple.emplace_back(pivot, std::move(row.payload));
+						m_rows[pivot] = Row();
+						m_pivots[i] = m_pivots.back();
+						m_pivots.pop_back();
+						continue;
+					}
+				}
+				++i;
+			}
+
+			if (!own.coefficients.empty()) {
+				own.coefficients.set(block, 0);
+				xor_into(own.payload, m_blocks[block]);
+				insert(std::move(own));
+			}
+		}
+	}
+
+	int m_num_blocks = 0;
+	int m_block_bits = 0;
+	std::vector<BitBuffer> m_blocks;
+	std::vector<char> m_known;
+
+	// indexed by pivot, empty coefficients if none
+	std::vector<Row> m_rows;
+	std::vector<int> m_pivots;
+
+	// blocks solved but not yet substituted
+	std::vector<std::pair<int, BitBuffer>> m_ripple;
+	std::vector<int> m_unknown;
+
+	int m_num_known = 0;
+	int m_num_received = 0;
+};
+
+}
@@ -16,12 +16,11 @@ public:
 		remove(NOTEBOOK_DIR "log.txt");
 		fd = fopen(NOTEBOOK_DIR "log.txt", "w");
 		assert(fd);
-		running.store(true);
 		worker = std::thread(&Logger::work, this);
 	}
 	~Logger()
 	{
-		running.store(false);
+		log.shutdown();
 		worker.join();
 		fflush(fd);
 		fclose(fd);
@@ -32,11 +31,7 @@ public:
 	void work()
 	{
 		std::string item;
-		while (running.load()) {
-			if (!log.pop(item)) {
-				std::this_thread::yield();
-				continue;
-			}
+		while (log.pop(item)) {
 			fprintf(fd, item.c_str());
 			fprintf(fd, "\n");
 		}
@@ -44,7 +39,6 @@ public:
 
 private:
 	SyncQueue<std::string> log;
-	std::atomic_bool running;
 	std::thread worker;
 	FILE* fd;
 };
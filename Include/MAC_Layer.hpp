@@ -17,7 +17,7 @@ namespace Athernet {
 using Bytes = std::vector<uint8_t>;
 
 class MAC_Layer {
-	using Frame = std::vector<int>;
+	using Frame = BitBuffer;
 
 public:
 	MAC_Layer(SyncQueue<Bytes>& packets)
@@ -34,6 +34,7 @@ public:
 	~MAC_Layer()
 	{
 		running.store(false);
+		m_recv_queue.shutdown();
 		worker.join();
 	}
 
@@ -47,14 +48,7 @@ public:
 
 			assert(payload.size() % 8 == 0);
 
-			Bytes bytes;
-			for (int i = 0; i < payload.size(); i += 8) {
-				uint8_t x = 0;
-				for (int j = 0; j < 8; ++j) {
-					x += (payload[i + j] << j);
-				}
-				bytes.push_back(x);
-			}
+			Bytes bytes = payload.to_bytes();
 
 			pcpp::EthLayer eth_layer(config.get_mac_by_id(config.get_self_id() ^ 1),
 				config.get_mac_by_id(config.get_self_id()), PCPP_ETHERTYPE_IP);
@@ -80,13 +74,14 @@ public:
 
 	std::vector<uint64_t> RTTs;
 
+	// * constructed before (and destroyed after) the sender / receiver threads using them
+	SenderSlidingWindow m_sender_window;
+	ReceiverSlidingWindow m_receiver_window;
+
 	MAC_Sender<float> m_sender;
 	MAC_Receiver<float> m_receiver;
 	PHY_Layer<float> phy_layer;
 
-	SenderSlidingWindow m_sender_window;
-	ReceiverSlidingWindow m_receiver_window;
-
 	std::atomic_bool running;
 	std::thread worker;
 };
@@ -1,4 +1,5 @@
 #pragma once
+#include "BitBuffer.hpp"
 #include "Config.hpp"
 #include "LT_Decode.hpp"
 #include "MacFrame.hpp"
@@ -8,15 +9,19 @@
 #include "RingBuffer.hpp"
 #include "SenderSlidingWindow.hpp"
 #include "SyncQueue.hpp"
+#include <algorithm>
 #include <atomic>
 #include <cstring>
+#include <functional>
 #include <thread>
 #include <vector>
 
 namespace Athernet {
 
 template <typename T> class MAC_Receiver {
-	using Frame = std::vector<int>;
+	using Frame = BitBuffer;
+	// LT coded frames, MAC header stripped
+	using CodedFrame = BitBuffer;
 
 public:
 	MAC_Receiver(Protocol_Control& mac_control, SyncQueue<Frame>& recv_queue,
@@ -26,9 +31,13 @@ public:
 		, m_recv_queue { recv_queue }
 		, m_sender_window { sender_window }
 		, m_receiver_window { receiver_window }
-		, frame_extractor(m_recv_buffer, m_phy_queue, m_decoder_queue, mac_control)
-	// , decoder(m_decoder_queue, m_recv_queue)
+		, frame_extractor(m_recv_buffer, m_phy_queue, mac_control)
+		, decoder(m_decoder_queue, m_file_queue)
 	{
+		// * back to the sender in our next ACK frame
+		decoder.set_on_report([this](int transfer, int chunk, bool last) {
+			control.push_lt_report(Protocol_Control::pack_lt_report(transfer, chunk, last));
+		});
 		display_running.store(true);
 		display_worker = std::thread(&MAC_Receiver::forward_frame, this);
 	}
@@ -36,24 +45,52 @@ public:
 	~MAC_Receiver()
 	{
 		display_running.store(false);
+		m_phy_queue.shutdown();
 		display_worker.join();
 	}
 
 	void push_stream(const float* buffer, int count)
 	{
 		bool result = true;
-		for (int i = 0; i < count; ++i) {
-			if constexpr (std::is_floating_point<T>::value) {
-				result = result && m_recv_buffer.push(buffer[i]);
-			} else {
-				result = result
-					&& m_recv_buffer.push(static_cast<T>(buffer[i] * Athernet::RECV_FLOAT_INT_SCALE));
+		if constexpr (std::is_same<T, float>::value) {
+			result = m_recv_buffer.push(std::span<const float>(buffer, count));
+		} else {
+			T converted[256];
+			for (int i = 0; i < count; i += 256) {
+				int chunk = std::min(count - i, 256);
+				for (int j = 0; j < chunk; ++j) {
+					converted[j] = static_cast<T>(buffer[i + j] * Athernet::RECV_FLOAT_INT_SCALE);
+				}
+				result = result && m_recv_buffer.push(std::span<const T>(converted, chunk));
 			}
 		}
 		// ! May change to busy waiting
 		assert(result);
 	}
 
+	// files decoded from LT coded frames (see LT_Send)
+	SyncQueue<Frame>& get_file_queue() { return m_file_queue; }
+
+	// chunk, whole file done (see LT_Decode::set_on_complete)
+	void set_on_file_complete(std::function<void(int, bool)> callback) { decoder.set_on_complete(std::move(callback)); }
+
+	// write received files to path instead of the file queue
+	void set_output_file(std::string path) { decoder.set_output_file(std::move(path)); }
+
+	const PHY_Stats& get_phy_stats() const { return frame_extractor.get_stats(); }
+
+	// samples not yet consumed by the frame extractor
+	int pending_samples() { return m_recv_buffer.size(); }
+
+	// address this node accepts, overrides Config::get_self_id() when >= 0
+	void set_self_id(int id) { m_self_id.store(id); }
+
+	int get_self_id() const
+	{
+		int id = m_self_id.load();
+		return id >= 0 ? id : config.get_self_id();
+	}
+
 	void forward_frame()
 	{
 		MacFrame mac_frame;
@@ -80,7 +117,7 @@ public:
 			}
 
 			// accept point to point / broadcast
-			if (mac_frame.to != config.get_self_id() && mac_frame.to != ((1 << 4) - 1))
+			if (mac_frame.to != get_self_id() && mac_frame.to != ((1 << 4) - 1))
 				continue;
 
 			if (mac_frame.is_syn) {
@@ -89,24 +126,95 @@ public:
 				continue;
 			}
 
-			if (mac_frame.has_ack) {
-				m_sender_window.remove_acked(mac_frame.ack);
+			if (mac_frame.has_report && mac_frame.report >= 0)
+				control.peer_snr.store(mac_frame.report);
+			if (mac_frame.has_lt_report) {
+				control.add_lt_decoded(
+					Protocol_Control::pack_lt_report(mac_frame.lt_transfer, mac_frame.lt_chunk, mac_frame.lt_last));
+			}
+			// * data frames only, ACKs are always NRZI; the bad ones too, a payload that fails says
+			// more about the link than none at all
+			if (!mac_frame.is_ack)
+				control.rx_snr.store(std::max(mac_frame.snr, 0));
+
+			if (mac_frame.has_ack || mac_frame.has_sack) {
+				m_sender_window.remove_acked(mac_frame.has_ack ? mac_frame.ack : -1, mac_frame.sack, control.clock.load());
 			}
 
 			if (!mac_frame.is_ack && !mac_frame.bad_data) {
-				control.ack.store(m_receiver_window.receive_packet(mac_frame.data, mac_frame.seq));
+				// * the window keeps payloads only, it travels as an extra last bit
+				mac_frame.data.push_back(mac_frame.is_aggregate);
+				int ack = m_receiver_window.receive_packet(mac_frame.data, mac_frame.seq);
+				auto state = Protocol_Control::pack_ack(ack, m_receiver_window.get_sack(), m_echo);
+				// * nothing new: a resend of a frame we have, our ACK was lost, send it again and louder
+				if (state == control.ack.load()) {
+					m_echo = !m_echo;
+					state = Protocol_Control::pack_ack(ack, m_receiver_window.get_sack(), m_echo);
+					control.ack_copies.store(std::min(control.ack_copies.load() + 1, config.get_max_ack_copies()));
+					m_acks_through = 0;
+				} else if (++m_acks_through >= 16) {
+					control.ack_copies.store(std::max(control.ack_copies.load() - 1, 1));
+					m_acks_through = 0;
+				}
+				control.ack.store(state);
 			}
 			if (m_receiver_window.get_num_collected() > 0) {
-				std::vector<std::vector<int>> mac_frames;
+				std::vector<Frame> mac_frames;
 				m_receiver_window.collect(mac_frames);
 				for (auto& x : mac_frames) {
-					m_recv_queue.push(std::move(x));
+					bool aggregate = x.back();
+					x.pop_back();
+					if (aggregate) {
+						deaggregate(x, m_subframes);
+						for (auto& subframe : m_subframes)
+							deliver(std::move(subframe));
+					} else {
+						deliver(std::move(x));
+					}
 				}
 			}
 		}
 	}
 
 private:
+	void deliver(Frame&& frame)
+	{
+		if (frame.empty())
+			return;
+		// last bit: LT coded
+		bool coded = frame.back();
+		frame.pop_back();
+		if (coded) {
+			m_decoder_queue.push(std::move(frame));
+		} else {
+			m_recv_queue.push(std::move(frame));
+		}
+	}
+
+	// sub-frames of an aggregated frame (see MAC_Sender::aggregate), damaged ones are dropped
+	void deaggregate(const Frame& frame, std::vector<Frame>& subframes)
+	{
+		subframes.clear();
+		const int length_bits = config.get_phy_frame_length_num_bits();
+		const auto& delimiter_crc = config.get_header_crc();
+		const auto& crc = config.get_payload_crc();
+		int pos = 0;
+		while (pos + length_bits + delimiter_crc.width() <= frame.size()) {
+			// * lost track of the boundaries, nothing after this can be trusted
+			if (!delimiter_crc.check(frame, pos, pos + length_bits + delimiter_crc.width()))
+				break;
+			int begin = pos + length_bits + delimiter_crc.width();
+			int end = begin + static_cast<int>(frame.extract(pos, length_bits));
+			if (end + crc.width() > frame.size())
+				break;
+			if (crc.check(frame, begin, end + crc.width()))
+				subframes.push_back(frame.slice(begin, end));
+			else
+				config.log("Bad sub-frame");
+			pos = end + crc.width();
+		}
+	}
+
 	Config& config;
 	Protocol_Control& control;
 	SyncQueue<Frame>& m_recv_queue;
@@ -114,11 +222,19 @@ private:
 	SenderSlidingWindow& m_sender_window;
 	ReceiverSlidingWindow& m_receiver_window;
 
+	std::atomic_int m_self_id = -1;
+	// forward_frame only, see Protocol_Control::pack_ack
+	bool m_echo = false;
+	// new frames since the last duplicate, our ACKs get through
+	int m_acks_through = 0;
+
 	RingBuffer<T> m_recv_buffer;
 	FrameExtractor<T> frame_extractor;
-	SyncQueue<Frame> m_decoder_queue;
-
-	// LT_Decode decoder;
+	SyncQueue<CodedFrame> m_decoder_queue;
+	SyncQueue<Frame> m_file_queue;
+	LT_Decode decoder;
+	// forward_frame only
+	std::vector<Frame> m_subframes;
 
 	std::atomic_bool display_running;
 	std::thread display_worker;
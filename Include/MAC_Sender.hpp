@@ -1,60 +1,114 @@
 #pragma once
 
+#include "BitBuffer.hpp"
 #include "Config.hpp"
+#include "PHY_FEC.hpp"
+#include "PHY_FrameStream.hpp"
+#include "PHY_LineCode.hpp"
+#include "PHY_OFDM.hpp"
 #include "PHY_Unit.hpp"
 #include "Protocol_Control.hpp"
 #include "RingBuffer.hpp"
 #include "SenderSlidingWindow.hpp"
 #include "SyncQueue.hpp"
+#include "WaveformCache.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <format>
 #include <mutex>
+#include <random>
+#include <span>
 #include <thread>
 #include <vector>
 namespace Athernet {
 
+// ACK airtime of one node
+struct MAC_Stats {
+	// standalone ACK frames
+	std::atomic<int64_t> acks = 0;
+	// data frames carrying a new ACK
+	std::atomic<int64_t> piggybacked = 0;
+	// frames the ACKs sent moved the peer past, either way
+	std::atomic<int64_t> acked_frames = 0;
+	std::atomic<int64_t> ack_samples = 0;
+	// what the standalone ACKs would have cost as 4 padded copies each
+	std::atomic<int64_t> fixed_ack_samples = 0;
+	// data frames rendered, by payload modulation and by code rate
+	std::atomic<int64_t> modulated[3] = {};
+	std::atomic<int64_t> coded[4] = {};
+};
+
 template <typename T> class MAC_Sender {
 	using Signal = std::vector<T>;
-	using Frame = std::vector<int>;
+	using Frame = BitBuffer;
 
 public:
 	MAC_Sender(Protocol_Control& mac_control, SenderSlidingWindow& sender_window)
 		: config { Athernet::Config::get_instance() }
+		, line_code { LineCode::get_instance() }
 		, control { mac_control }
 		, m_sender_window { sender_window }
+		, m_requests(64)
+		, m_released(64)
+		, m_log_events(1024)
+		, m_sent(64)
+		, m_rendered(64)
 	{
+		m_frames.reserve(NUM_SIGNALS);
+		for (int i = 0; i < NUM_SIGNALS; ++i)
+			m_frames.emplace_back(max_head_length(), max_line_bits());
 		running.store(true);
 		worker = std::thread(&MAC_Sender::send_loop, this);
-		start = 0;
-		packet.reset();
+		synth_worker = std::thread(&MAC_Sender::synth_loop, this);
 	}
 	~MAC_Sender()
 	{
 		running.store(false);
+		m_send_queue.shutdown();
+		m_sender_window.shutdown();
+		wake_synth();
 		worker.join();
+		synth_worker.join();
 	}
 
 	void push_frame(const Frame& frame) { m_send_queue.push(frame); }
 	void push_frame(Frame&& frame) { m_send_queue.push(std::move(frame)); }
 
+	// frames pushed but not yet in the sliding window
+	int queued_frames() { return static_cast<int>(m_send_queue.size()); }
+
+	const MAC_Stats& get_mac_stats() const { return m_stats; }
+
 	void send_loop()
 	{
 		state = PhySendState::PROCESS_FRAME;
-		std::vector<int> frame;
+		Frame frame;
 		std::shared_ptr<PHY_Unit> phy_unit;
 		while (running.load()) {
 			if (state == PhySendState::PROCESS_FRAME) {
-				if (!m_send_queue.pop(frame)) {
+				if (m_has_held) {
+					frame = std::move(m_held);
+					m_has_held = false;
+				} else if (!m_send_queue.pop(frame)) {
 					continue;
 				}
-				assert(frame.size() <= config.get_phy_frame_payload_symbol_limit());
+				assert(frame.size() <= frame_capacity(CodeRate::NONE));
+
+				// * whatever queues up while the window is full goes out in the same frame
+				if (!m_sender_window.wait_for_space())
+					continue;
+				bool aggregated = aggregate(frame);
 
 				int seq_num = m_sender_window.get_next_seq();
-				phy_unit = std::make_shared<PHY_Unit>(std::move(frame), seq_num);
+				phy_unit = std::make_shared<PHY_Unit>(std::move(frame), seq_num, aggregated);
 
 				state = PhySendState::SEND_SIGNAL;
 			} else if (state == PhySendState::SEND_SIGNAL) {
 				if (!m_sender_window.try_push(phy_unit)) {
 					continue;
 				} else {
+					wake_synth();
 					state = PhySendState::PROCESS_FRAME;
 				}
 			} else if (state == PhySendState::INVALID_STATE) {
@@ -64,45 +118,64 @@ public:
 		}
 	}
 
+	// payload modulation of the data frames from now on, ACK / SYN frames are always 4B5B + NRZI;
+	// the receiver finds it in the MAC header
+	void set_modulation(Modulation modulation) { m_modulation.store(modulation); }
+
+	Modulation get_modulation() const { return m_modulation.load(); }
+
+	// convolutional code of the data frame payloads from now on (after the MAC header, CRC
+	// included), ACK / SYN frames are not coded; the receiver finds it in the PHY header
+	void set_code_rate(CodeRate rate) { m_code_rate.store(rate); }
+
+	CodeRate get_code_rate() const { return m_code_rate.load(); }
+
+	// longest frame for push_frame() at the code rate set now, see max_frame_bits(CodeRate); up to
+	// frame_capacity(CodeRate::NONE) go out uncoded and without the link report. While the link
+	// adapts, what the heaviest rate takes: aggregation fills the frames of the lighter ones
+	int max_frame_bits() const
+	{
+		return max_frame_bits(m_link_adaptation.load() ? CodeRate::R1_2 : m_code_rate.load());
+	}
+
+	// pick the modulation and code rate of every data frame from the SNR the peer reports (see
+	// Config::get_mcs_min_snr, mcs_steps), set_modulation() / set_code_rate() are where it starts
+	// until the first report; NRZI frames keep the code rate set_code_rate() says
+	void set_link_adaptation(bool enabled) { m_link_adaptation.store(enabled); }
+
+	bool get_link_adaptation() const { return m_link_adaptation.load(); }
+
+	// address this node sends from, overrides Config::get_self_id() when >= 0
+	void set_self_id(int id) { m_self_id.store(id); }
+
+	int get_self_id() const
+	{
+		int id = m_self_id.load();
+		return id >= 0 ? id : config.get_self_id();
+	}
+
+	// synth_loop has handled every request / frame handed to it so far
+	bool synth_idle() const
+	{
+		return m_synth_seen.load(std::memory_order_acquire) == m_synth_signal.load(std::memory_order_acquire);
+	}
+
+	// audio thread: a frame of ours is on air
+	bool transmitting() const { return hold_channel; }
+
+	// * audio thread: no allocation, no locks, no std::format
 	int pop_stream(float* buffer, int count)
 	{
-		static int counter = 0;
-
-		static int hold_channel = 0;
-		static int trying_channel = 0;
-		static int jammed = 0;
-		static int slot = 16;
-		static int backoff = 1;
-		static int ack_timeout = 0;
-		static int ack_timeout_times = 0;
-		static int last_ack = -1;
-		static int cur_ack = -1;
-		static int syn_issued = 0;
-		static int syn_sent = 0;
-		static int registered_ack = -1;
-		static int ack_flying = 0;
-		static int continuous_sent = 0;
+		collect_rendered();
 
 		if (control.transmission_start.load()) {
 			control.clock.fetch_add(1);
 		}
 
-		int ack_value = control.ack.load();
-		if (ack_value != registered_ack) {
-			ack_timeout_times = 0;
-			registered_ack = ack_value;
-		}
-
-		if (ack_timeout_times > 10) {
-			// no more messages / link dead
-			return 0;
-		}
-
-		if (!packet) {
+		if (!has_packet) {
 			if (!control.transmission_start.load()) {
-				if (config.get_self_id() == 0) {
-					if (!syn_issued) {
-						gen_syn();
+				if (get_self_id() == 0) {
+					if (!syn_issued && request(SignalKind::SYN)) {
 						syn_issued = 1;
 					}
 					if (syn_sent) {
@@ -112,43 +185,50 @@ public:
 					return 0;
 				}
 			} else {
-				srand(config.get_self_id() + rand());
-				if (ack_timeout > slot * 10 * (ack_timeout_times + 1) * (ack_timeout_times + 1)) {
-					m_sender_window.reset();
-					ack_timeout = 0;
-					++ack_timeout_times;
+				m_random.seed(get_self_id() + m_random());
+				// * retransmit timers (RTO from the measured RTT) live in the window, synth_loop
+				// has to look at it again once one runs out
+				if (m_data_requested && !m_timer_woken && m_sender_window.timer_due(control.clock.load())) {
+					wake_synth();
+					m_timer_woken = true;
 				}
 
-				bool succ = m_sender_window.consume_one(packet);
+				// don't swap waveforms under an ACK on air
+				bool succ = !hold_channel && take_data();
 				if (!succ) {
-					if (!control.busy.load())
-						++ack_timeout;
-					if (control.collision.load())
-						ack_timeout = 0;
-					int ack = control.ack.load();
-					if (ack != last_ack && ack != cur_ack && !ack_flying) {
-						cur_ack = ack;
-						gen_ack(cur_ack);
-						ack_flying = 1;
+					int64_t ack = control.ack.load();
+					// * LT reports still queued go out in ACKs of their own, new ACK number or not
+					bool lt_report = control.has_lt_report();
+					if (((ack != last_ack && ack != cur_ack) || lt_report) && !ack_flying) {
+						if (m_ack_since < 0)
+							m_ack_since = control.clock.load();
+						if (ack_due(ack) && request(SignalKind::ACK, ack)) {
+							cur_ack = ack;
+							ack_flying = 1;
+							report_flying = lt_report;
+						}
 					}
 
-					if (control.ack.load() == last_ack) {
+					// nothing on air, or an ACK held back for data to carry it
+					if ((control.ack.load() == last_ack && !report_flying) || !ack_flying) {
 						hold_channel = 0;
 						return 0;
 					}
-				} else {
-					ack_timeout = 0;
-					cur_ack = control.ack.load();
-					modulate(packet->frame, packet->seq, cur_ack);
 				}
 			}
 		} else {
-			if (!hold_channel && control.ack.load() != cur_ack) {
-				cur_ack = control.ack.load();
-				modulate(packet->frame, packet->seq, cur_ack);
+			int64_t ack = control.ack.load();
+			if (!hold_channel && ack != cur_ack && request(SignalKind::REMODULATE, ack)) {
+				cur_ack = ack;
 			}
 		}
 
+		// waveform still being rendered
+		if (m_waiting && !hold_channel) {
+			return 0;
+		}
+		auto& frame = current_frame();
+
 		// race begin
 		if (!hold_channel) {
 			if (!control.busy.load()) {
@@ -157,24 +237,14 @@ public:
 
 				// race!
 				if (counter < 0) {
-					config.log(std::format("+++++RETRY+++++ happened at {} ", control.clock.load()));
-					// if (control.previlege_node != config.get_self_id()) {
-					// 	m_sender_window.reset();
-					// 	if (m_sender_window.consume_one(packet)) {
-					// 		modulate(packet->frame, packet->seq, control.ack.load());
-					// 	}
-					// }
+					log("+++++RETRY+++++ happened at {} ", control.clock.load());
 
 					// shoot!
 					hold_channel = 1;
 					continuous_sent = 0;
 					jammed = 0;
-					start = 0;
-					int index = 0;
-					for (int i = start; index < count && i < signal.size(); ++i, ++start) {
-						buffer[index++] = signal[i];
-					}
-					return index;
+					frame.rewind();
+					return frame.read(buffer, count);
 				}
 				return 0;
 			} else {
@@ -183,34 +253,39 @@ public:
 			}
 		} else {
 			if (control.collision.load()) {
-				config.log(std::format("*****CLASH***** happened at {} ", control.clock.load()));
+				log("*****CLASH***** happened at {} ", control.clock.load());
 				// collide!
 				hold_channel = 0;
 				backoff <<= 1;
 				if (backoff > 8)
 					backoff = 8;
-				counter = (rand() % backoff) * slot;
+				counter = (m_random() % backoff) * slot;
 
-				config.log(std::format("Counter set to {} ", counter));
+				log("Counter set to {} ", counter);
 				if (!jammed) {
 					for (int i = 0; i < count; ++i) {
-						buffer[i] = (float)(rand() % 50 + 50) / 100;
+						buffer[i] = (float)(m_random() % 50 + 50) / 100;
 					}
 					jammed = 1;
 					return count;
 				}
 				return 0;
 			} else {
-				int index = 0;
-				for (int i = start; index < count && i < signal.size(); ++i, ++start) {
-					buffer[index++] = signal[i];
-				}
-				if (start >= signal.size()) {
-					config.log(std::format("^^^^^SENT^^^^^ at {}", control.clock.load()));
-					start = 0;
-					packet.reset();
+				int index = frame.read(buffer, count);
+				if (frame.done()) {
+					log("^^^^^SENT^^^^^ at {}", control.clock.load());
+					// the retransmit timer / RTT of a data frame run from here
+					if (has_packet)
+						sent(m_data_seq);
+					count_ack(frame.size());
+					frame.rewind();
+					if (has_packet)
+						cur_ack = carried_ack();
+					has_packet = false;
 					last_ack = cur_ack;
 					ack_flying = 0;
+					report_flying = 0;
+					m_ack_since = -1;
 					counter = slot >> 1;
 					backoff = 1;
 					if (syn_issued && !control.transmission_start.load()) {
@@ -223,169 +298,295 @@ public:
 	}
 
 private:
-	void append_num(int num, int num_bits, Frame& frame)
+	// * ------------------------- ACK scheduling ------------------------- *
+	// Data frames carry the ACK anyway, a standalone one waits up to get_ack_delay() ticks for
+	// one to come along and for more frames to cover. Gaps (SACK), a peer that retransmits what
+	// we have already (echo flipped), an LT report and every second frame are ACKed right away.
+	bool ack_due(int64_t ack)
 	{
-		for (int i = 0; i < num_bits; ++i) {
-			frame.push_back((num >> i) & 1);
-		}
+		if (Protocol_Control::unpack_sack(ack) || last_ack == Protocol_Control::NO_ACK
+			|| control.has_lt_report()
+			|| Protocol_Control::unpack_echo(ack) != Protocol_Control::unpack_echo(last_ack))
+			return true;
+		if (acked_since(ack, last_ack) >= 2)
+			return true;
+		return control.clock.load() - m_ack_since >= config.get_ack_delay();
 	}
 
-	void modulate(Frame frame, int seq_num, int ack_num)
+	// what the peer knows of cur_ack after a data frame: the cumulative ACK only, SACK and echo go
+	// in a standalone ACK and stay as the last one left them (the bitmap while it's relative to the
+	// same cumulative ACK)
+	int64_t carried_ack() const
 	{
-		signal.clear();
-		append_preamble(signal);
+		const int ack = Protocol_Control::unpack_ack(cur_ack);
+		const uint32_t sack = ack == Protocol_Control::unpack_ack(last_ack) ? Protocol_Control::unpack_sack(last_ack) : 0;
+		return Protocol_Control::pack_ack(ack, sack, Protocol_Control::unpack_echo(last_ack));
+	}
 
-		assert(frame.size() < (1ULL << config.get_phy_frame_length_num_bits()));
-		Frame length;
-		append_num(frame.size() + 32, config.get_phy_frame_length_num_bits(), length);
-		modulate_vec_4b5b_nrzi(length, signal);
+	// frames ack covers that last did not
+	int acked_since(int64_t ack, int64_t last)
+	{
+		const int limit = config.get_seq_limit();
+		if (Protocol_Control::unpack_ack(ack) < 0)
+			return 0;
+		if (last == Protocol_Control::NO_ACK)
+			return Protocol_Control::unpack_ack(ack) + 1;
+		return (Protocol_Control::unpack_ack(ack) - Protocol_Control::unpack_ack(last) + limit) % limit;
+	}
 
-		Frame mac_frame;
-		// to
-		append_num(config.get_self_id() ^ 1, 4, mac_frame);
-		// from
-		append_num(config.get_self_id(), 4, mac_frame);
-		// seq
-		append_num(seq_num, 8, mac_frame);
-		// control_section
-		Frame control_section = { 0, 0, 0, 0, 0, 0, 0, 0 };
-		// ack
-		if (ack_num != -1) {
-			append_num(ack_num, 8, mac_frame);
-			control_section[0] = 1;
+	// audio thread, a frame just went out with cur_ack
+	void count_ack(int num_samples)
+	{
+		if (!control.transmission_start.load() || cur_ack == last_ack || cur_ack == Protocol_Control::NO_ACK)
+			return;
+		if (has_packet) {
+			m_stats.piggybacked.fetch_add(1, std::memory_order_relaxed);
 		} else {
-			append_num(0, 8, mac_frame);
+			m_stats.acks.fetch_add(1, std::memory_order_relaxed);
+			m_stats.ack_samples.fetch_add(num_samples, std::memory_order_relaxed);
+			m_stats.fixed_ack_samples.fetch_add(m_fixed_ack_length, std::memory_order_relaxed);
 		}
-		// add control section
-		append_vec(control_section, mac_frame);
-		// crc for mac header
-		append_crc8(mac_frame);
-		// crc for payload
-		append_crc8(frame);
-		// add payload
-		append_vec(frame, mac_frame);
+		m_stats.acked_frames.fetch_add(acked_since(cur_ack, last_ack), std::memory_order_relaxed);
+	}
 
-		// modulate_vec(mac_frame, signal);
-		modulate_vec_4b5b_nrzi(mac_frame, signal);
+	// * ------------------------- frame aggregation ------------------------- *
+	// Frames queued behind first are packed into it as sub-frames, up to the payload limit:
+	// length | CRC of the length | frame | CRC of the frame
+	// The delimiter CRC keeps the receiver from running off with a broken length, the per sub-frame
+	// CRC drops what the frame CRC let through. One MAC header, preamble and channel access for all.
+	bool aggregate(Frame& first)
+	{
+		const int limit = max_frame_bits(link_code_rate());
+		Frame next;
+		if (!m_send_queue.try_pop(next))
+			return false;
+
+		Frame packed;
+		if (subframe_bits(first) + subframe_bits(next) > limit) {
+			hold(std::move(next));
+			return false;
+		}
+		append_subframe(packed, first);
+		append_subframe(packed, next);
+		while (m_send_queue.try_pop(next)) {
+			if (packed.size() + subframe_bits(next) > limit) {
+				hold(std::move(next));
+				break;
+			}
+			append_subframe(packed, next);
+		}
+		first = std::move(packed);
+		return true;
+	}
+
+	int subframe_bits(const Frame& frame)
+	{
+		return config.get_phy_frame_length_num_bits() + config.get_header_crc().width() + frame.size()
+			+ config.get_payload_crc().width();
 	}
 
-	void gen_ack(int ack_num)
+	void append_subframe(Frame& packed, const Frame& frame)
 	{
-		signal.clear();
+		int begin = packed.size();
+		packed.append(frame.size(), config.get_phy_frame_length_num_bits());
+		packed.append(config.get_header_crc().compute(packed, begin, packed.size()), config.get_header_crc().width());
+		begin = packed.size();
+		packed.append(frame);
+		packed.append(config.get_payload_crc().compute(packed, begin, packed.size()), config.get_payload_crc().width());
+	}
+
+	// * longest frame a data frame carries at rate. Coded, no longer on air than the longest frame
+	// without: 4B5B + NRZI has no timing recovery, a long frame goes out of step with a clock that
+	// drifts (and the modulation is only picked when the frame goes out)
+	int max_frame_bits(CodeRate rate) const { return frame_capacity(rate) - config.get_link_report_bits(); }
+
+	// the same without the link report
+	int frame_capacity(CodeRate rate) const
+	{
+		// the length field of the PHY frame counts the MAC header too
+		int limit = config.get_phy_frame_payload_symbol_limit() - 32;
+		if (rate != CodeRate::NONE) {
+			const int crc = config.get_payload_crc().width();
+			limit = ConvolutionalCode::max_bits(limit + crc, rate) - crc;
+		}
+		return limit;
+	}
+
+	// rate, or a lighter one if the frame is too long for it (queued before the rate changed, or
+	// pushed whole)
+	CodeRate frame_rate(int frame_bits, CodeRate rate) const
+	{
+		while (rate != CodeRate::NONE && frame_bits > max_frame_bits(rate))
+			rate = rate == CodeRate::R3_4 ? CodeRate::NONE : static_cast<CodeRate>(static_cast<int>(rate) + 1);
+		return rate;
+	}
+
+	// next frame of send_loop, it did not fit
+	void hold(Frame&& frame)
+	{
+		m_held = std::move(frame);
+		m_has_held = true;
+	}
+
+	// ack_state: see Protocol_Control::pack_ack, data frames carry the cumulative ACK only;
+	// preamble and PHY header are rendered here, the rest as the frame goes out (see FrameStream)
+	void modulate(FrameStream<T>& stream, const Frame& frame, int seq_num, int64_t ack_state, bool aggregated)
+	{
+		int ack_num = Protocol_Control::unpack_ack(ack_state);
+		stream.clear();
+		Signal& signal = stream.head();
 		append_preamble(signal);
 
-		Frame frame = std::vector<int>(50);
-		Frame length;
-		append_num(frame.size() + 32, config.get_phy_frame_length_num_bits(), length);
-		modulate_vec_4b5b_nrzi(length, signal);
+		const MCS mcs = pick_mcs();
+		const CodeRate rate = frame_rate(frame.size(), mcs.rate);
+		m_stats.coded[static_cast<int>(rate)].fetch_add(1, std::memory_order_relaxed);
+		Frame payload;
+		// * a frame as long as the PHY header allows has no room for the report, the next one takes it
+		int control_section = frame.size() <= max_frame_bits(rate) ? append_report(payload) : 0;
+		payload.append(frame);
+		append_phy_header(payload.size() + 32, rate, signal);
 
 		Frame mac_frame;
 		// to
-		append_num(config.get_self_id() ^ 1, 4, mac_frame);
+		mac_frame.append(get_self_id() ^ 1, 4);
 		// from
-		append_num(config.get_self_id(), 4, mac_frame);
+		mac_frame.append(get_self_id(), 4);
 		// seq
-		append_num(0, 8, mac_frame);
+		mac_frame.append(seq_num, 8);
 		// control_section
-		Frame control_section = { 0, 0, 0, 0, 0, 0, 0, 0 };
-		// is ack
-		control_section[1] = 1;
+		const Modulation modulation = mcs.modulation;
+		m_stats.modulated[static_cast<int>(modulation)].fetch_add(1, std::memory_order_relaxed);
+		control_section |= (aggregated ? 1 << 4 : 0) | static_cast<int>(modulation) << 5;
 		// ack
 		if (ack_num != -1) {
-			append_num(ack_num, 8, mac_frame);
-			control_section[0] = 1;
+			mac_frame.append(ack_num, 8);
+			control_section |= 1;
 		} else {
-			append_num(0, 8, mac_frame);
+			mac_frame.append(0, 8);
 		}
 		// add control section
-		append_vec(control_section, mac_frame);
+		mac_frame.append(control_section, 8);
 		// crc for mac header
-		append_crc8(mac_frame);
+		config.get_header_crc().append(mac_frame);
 		// crc for payload
-		append_crc8(frame);
+		config.get_payload_crc().append(payload);
+		if (rate != CodeRate::NONE) {
+			Frame coded;
+			coded.reserve(ConvolutionalCode::coded_bits(payload.size(), rate));
+			m_fec.encode(payload, rate, coded);
+			payload = std::move(coded);
+		}
+		if (modulation == Modulation::NRZI_4B5B) {
+			// add payload
+			mac_frame.append(payload);
+			stream.set_line(mac_frame);
+		} else {
+			// * header (40 bits, whole 4B5B symbols) then the OFDM symbols right after it
+			stream.set_line(mac_frame);
+			stream.set_payload(payload, modulation);
+		}
+	}
+
+	void gen_ack(Signal& signal, int64_t ack_state)
+	{
+		int ack_num = Protocol_Control::unpack_ack(ack_state);
+
+		// * header only unless there are gaps, then the SACK bitmap up to its last set bit
+		uint32_t sack = Protocol_Control::unpack_sack(ack_state);
+		Frame frame;
+		int report = append_report(frame);
+		int lt_report = append_lt_report(frame);
+		if (sack)
+			frame.append(sack, (std::bit_width(sack) + 3) / 4 * 4);
+		// is ack, has SACK
+		int control_section = 1 << 1 | (sack ? 1 << 3 : 0) | report | lt_report | (ack_num != -1);
+
+		// * everything up to the MAC header CRC only changes with the ACK number, the control section
+		// and the length: cached, the reports and SACK go on after it
+		const int mac_bits = frame.size() + 32;
+		const uint64_t key = static_cast<uint64_t>(mac_bits) << 24 | static_cast<uint64_t>(ack_num + 1) << 12
+			| control_section << 4 | get_self_id();
+		auto header = m_waveforms.get(
+			key, [&](Signal& arena) { append_control_header(ack_num, control_section, mac_bits, arena); });
+		signal.assign(std::begin(header), std::end(header));
+		// crc for payload
+		config.get_payload_crc().append(frame);
 		// add payload
-		append_vec(frame, mac_frame);
+		append_continued(frame, signal);
 
-		// modulate_vec(mac_frame, signal);
-		// modulate_vec(mac_frame, signal);
-		// modulate_vec(mac_frame, signal);
-		// modulate_vec(mac_frame, signal);
-		modulate_vec_4b5b_nrzi(mac_frame, signal);
+		// * copies: 1 on a clean link, more while the peer keeps retransmitting (see MAC_Receiver)
+		int copies = std::clamp(control.ack_copies.load(), 1, config.get_max_ack_copies());
 		int signal_size = signal.size();
-		signal.resize(signal_size * 2);
-		std::copy(std::begin(signal), std::begin(signal) + signal_size, std::begin(signal) + signal_size);
-		signal_size = signal.size();
-		signal.resize(signal_size * 2);
-		std::copy(std::begin(signal), std::begin(signal) + signal_size, std::begin(signal) + signal_size);
+		signal.resize(signal_size * copies);
+		for (int i = 1; i < copies; ++i)
+			std::copy(std::begin(signal), std::begin(signal) + signal_size, std::begin(signal) + i * signal_size);
 	}
 
-	void gen_syn()
+	void gen_syn(Signal& signal)
 	{
-		signal.clear();
-		append_preamble(signal);
+		// * nothing in it changes but the sender and the payload CRC width: cached whole
+		const uint64_t key
+			= 1ULL << 63 | static_cast<uint64_t>(config.get_payload_crc().width()) << 8 | get_self_id();
+		auto syn = m_waveforms.get(key, [&](Signal& arena) {
+			Frame frame(300);
+			append_control_header(-1, 1 << 2, frame.size() + 32, arena);
+			// crc for payload
+			config.get_payload_crc().append(frame);
+			// add payload
+			append_continued(frame, arena);
+		});
+		signal.assign(std::begin(syn), std::end(syn));
+	}
 
-		Frame frame = std::vector<int>(300);
-		Frame length;
-		append_num(frame.size() + 32, config.get_phy_frame_length_num_bits(), length);
-		modulate_vec_4b5b_nrzi(length, signal);
+	// preamble, PHY header and MAC header of an ACK / SYN frame (control_section bit 2), to the peer
+	// or broadcast; ack_num -1 for none
+	void append_control_header(int ack_num, int control_section, int mac_bits, Signal& signal)
+	{
+		append_preamble(signal);
+		append_phy_header(mac_bits, CodeRate::NONE, signal);
 
 		Frame mac_frame;
-		// broad cast
-		append_num((1 << 4) - 1, 4, mac_frame);
+		// to, broadcast for a SYN
+		mac_frame.append(control_section & 1 << 2 ? (1 << 4) - 1 : get_self_id() ^ 1, 4);
 		// from
-		append_num(config.get_self_id(), 4, mac_frame);
+		mac_frame.append(get_self_id(), 4);
 		// seq
-		append_num(0, 8, mac_frame);
+		mac_frame.append(0, 8);
 		// ack
-		append_num(0, 8, mac_frame);
-		// control_section
-		Frame control_section = { 0, 0, 1, 0, 0, 0, 0, 0 };
-
+		mac_frame.append(ack_num != -1 ? ack_num : 0, 8);
 		// add control section
-		append_vec(control_section, mac_frame);
+		mac_frame.append(control_section, 8);
 		// crc for mac header
-		append_crc8(mac_frame);
-		// crc for payload
-		append_crc8(frame);
-		// add payload
-		append_vec(frame, mac_frame);
-
+		config.get_header_crc().append(mac_frame);
 		modulate_vec_4b5b_nrzi(mac_frame, signal);
 	}
 
 	void append_preamble(Signal& signal) { append_vec(config.get_preamble(Athernet::Tag<T>()), signal); }
 
-	Frame encode_4b5b(const Frame& frame)
+	// after the preamble: length of the MAC frame in bits (header included, not coded) and the code
+	// of its payload
+	void append_phy_header(int mac_bits, CodeRate rate, Signal& signal)
 	{
-		Frame ret;
-		for (int i = 0; i < frame.size(); i += 4) {
-			int x = 0;
-			for (int j = 0; j < 4; ++j) {
-				int bit = (i + j < frame.size()) ? frame[i + j] : 0;
-				x += bit << j;
-			}
-			int y = config.get_map_4b_5b(x);
-			for (int j = 0; j < 5; ++j) {
-				ret.push_back((y >> j) & 1);
-			}
-		}
-		return ret;
+		assert(mac_bits < (1 << config.get_phy_frame_length_num_bits()));
+		Frame header;
+		header.append(mac_bits, config.get_phy_frame_length_num_bits());
+		header.append(static_cast<int>(rate) * 5, config.get_phy_frame_code_num_bits());
+		modulate_vec_4b5b_nrzi(header, signal);
 	}
 
 	void modulate_vec_4b5b_nrzi(const Frame& frame, Signal& signal)
 	{
-		float last = 1.0f;
-		signal.push_back(last);
-		signal.push_back(last);
-		auto encoded_4b5b = encode_4b5b(frame);
-		// std::cerr << frame.size() << "mapped to " << encoded_4b5b.size() << "\n";
-		for (auto x : encoded_4b5b) {
-			if (x == 1) {
-				last = -last;
-			}
-			signal.push_back(last);
-			signal.push_back(last);
-		}
+		const int begin = signal.size();
+		signal.resize(begin + LineCode::num_samples(frame.size()));
+		line_code.modulate(frame, std::span<T>(signal).subspan(begin));
+	}
+
+	// bits on the line code of the frame signal ends with (whole code words so far)
+	void append_continued(const Frame& bits, Signal& signal)
+	{
+		const int begin = signal.size();
+		signal.resize(begin + LineCode::num_samples(bits.size()) - LineCode::SAMPLES_PER_LEVEL);
+		line_code.modulate_continued(bits, std::span<T>(signal).subspan(begin), signal[begin - 1] < 0);
 	}
 
 	void modulate_vec(const Frame& frame, Signal& signal)
@@ -419,47 +620,437 @@ private:
 		}
 	}
 
-	void append_crc8(Frame& frame)
+	void append_silence(Signal& signal) { append_vec(m_silence, signal); }
+
+	template <typename U> void append_vec(const std::vector<U>& from, std::vector<U>& to)
 	{
-		Frame saved_frame { frame };
-		for (int i = 0; i < config.get_crc_residual_length(); ++i)
-			frame.push_back(0);
+		std::copy(std::begin(from), std::end(from), std::back_inserter(to));
+	}
 
-		for (int i = 0; i < frame.size() - config.get_crc_residual_length(); ++i) {
-			if (frame[i]) {
-				for (int offset = 0; offset < config.get_crc_length(); ++offset) {
-					frame[i + offset] ^= config.get_crc()[offset];
-				}
+	// * ------------------------- signal synthesis ------------------------- *
+	// Waveforms are rendered by synth_loop into a fixed pool of signals; the audio thread and
+	// synth_loop only pass slot numbers, requests and log events through SPSC rings.
+
+	enum class SignalKind { DATA, REMODULATE, ACK, SYN };
+
+	struct SynthRequest {
+		SignalKind kind;
+		int64_t ack;
+	};
+
+	struct Rendered {
+		SignalKind kind;
+		int slot;
+		int64_t ack;
+		// DATA
+		int seq = -1;
+	};
+
+	struct SentEvent {
+		int seq;
+		int clock;
+	};
+
+	struct LogEvent {
+		// string literal with one {}
+		const char* format;
+		int value;
+	};
+
+	static constexpr int NUM_SIGNALS = 4;
+
+	// 4B5B + NRZI, 2 samples per level plus the leading one; preamble and PHY header included
+	int frame_length(int mac_bits, CodeRate rate = CodeRate::NONE)
+	{
+		int header = LineCode::num_samples(config.get_phy_frame_length_num_bits() + config.get_phy_frame_code_num_bits())
+			+ config.get_preamble_length();
+		return header + LineCode::num_samples(32 + config.get_header_crc().width() + payload_bits(mac_bits, rate));
+	}
+
+	// on air after the MAC header and its CRC: mac_bits and the payload CRC, coded
+	int payload_bits(int mac_bits, CodeRate rate)
+	{
+		int bits = mac_bits + config.get_payload_crc().width();
+		return rate == CodeRate::NONE ? bits : ConvolutionalCode::coded_bits(bits, rate);
+	}
+
+	// * ------------------------- link adaptation ------------------------- *
+	// Every frame reports how the last frame of the peer came in, after the MAC header (control_section
+	// bit 7); the sender moves its data frames to the fastest modulation the peer's report allows.
+	// The report of NRZI frames comes from the preamble, of OFDM frames from their EVM: a link with
+	// echoes too long for NRZI may still be fine for OFDM.
+
+	// the report into bits, returns the control_section bit for it (none before the first frame)
+	int append_report(Frame& bits)
+	{
+		int snr = control.rx_snr.load();
+		if (snr < 0)
+			return 0;
+		const int report_bits = config.get_link_report_bits();
+		bits.append(std::min(snr, (1 << report_bits) - 1), report_bits);
+		return 1 << 7;
+	}
+
+	// LT completion for the peer (see LT_Decode::set_on_report) into an ACK frame, returns the
+	// control_section bit for it: bit 4, aggregation is for data frames only. One per ACK, the rest
+	// keep the next ACKs due; sent once, a frame of the chunk that still comes in brings it back
+	int append_lt_report(Frame& bits)
+	{
+		int64_t report = control.pop_lt_report();
+		if (report == Protocol_Control::NO_LT_REPORT)
+			return 0;
+		bits.append(Protocol_Control::unpack_lt_transfer(report), config.get_lt_transfer_bits());
+		bits.append(Protocol_Control::unpack_lt_chunk(report), config.get_lt_chunk_bits());
+		bits.push_back(Protocol_Control::unpack_lt_last(report));
+		return 1 << 4;
+	}
+
+	struct MCS {
+		Modulation modulation;
+		CodeRate rate;
+	};
+
+	// * the steps link adaptation moves along, slowest first: coded QPSK lets OFDM in well below
+	// what QPSK alone needs. 16-QAM at 1/2 carries no more than QPSK uncoded and is left out, NRZI
+	// has the code rate set_code_rate() says
+	static constexpr MCS mcs_steps[] = { { Modulation::NRZI_4B5B, CodeRate::NONE },
+		{ Modulation::OFDM_QPSK, CodeRate::R1_2 }, { Modulation::OFDM_QPSK, CodeRate::R2_3 },
+		{ Modulation::OFDM_QPSK, CodeRate::R3_4 }, { Modulation::OFDM_QPSK, CodeRate::NONE },
+		{ Modulation::OFDM_16QAM, CodeRate::R2_3 }, { Modulation::OFDM_16QAM, CodeRate::R3_4 },
+		{ Modulation::OFDM_16QAM, CodeRate::NONE } };
+	static constexpr int num_mcs_steps = static_cast<int>(std::size(mcs_steps));
+
+	// the step of modulation at rate, or its slowest
+	static int mcs_step(Modulation modulation, CodeRate rate)
+	{
+		int slowest = -1;
+		for (int i = 0; i < num_mcs_steps; ++i) {
+			if (mcs_steps[i].modulation != modulation)
+				continue;
+			if (mcs_steps[i].rate == rate)
+				return i;
+			if (slowest < 0)
+				slowest = i;
+		}
+		return std::max(slowest, 0);
+	}
+
+	// code rate of the data frames going out now, for the frames sent next to fit
+	CodeRate link_code_rate() const
+	{
+		return m_link_adaptation.load() ? m_link_rate.load() : m_code_rate.load();
+	}
+
+	// synth_loop only
+	MCS pick_mcs()
+	{
+		int snr = control.peer_snr.load();
+		if (!m_link_adaptation.load() || snr < 0) {
+			m_link_step = mcs_step(m_modulation.load(), m_code_rate.load());
+			m_link_rate.store(m_code_rate.load());
+			return { m_modulation.load(), m_code_rate.load() };
+		}
+
+		// * up one step at a time: the report of an NRZI frame comes from its preamble, the first
+		// OFDM frames tell how OFDM really fares
+		int limit = m_link_step + 1;
+		if (m_loss_hold > 0) {
+			--m_loss_hold;
+			limit = std::min(limit, m_loss_ceiling);
+		}
+		int best = 0;
+		for (int i = 1; i <= limit && i < num_mcs_steps; ++i) {
+			const MCS& candidate = mcs_steps[i];
+			int needed = config.get_mcs_min_snr(candidate.modulation) - config.get_mcs_coding_gain(candidate.rate)
+				+ (i > m_link_step ? config.get_mcs_hysteresis() : 0);
+			if (snr >= needed)
+				best = i;
+		}
+		if (best != m_link_step)
+			config.log(std::format("MCS {}", best));
+		m_link_step = best;
+		MCS mcs = mcs_steps[best];
+		if (mcs.modulation == Modulation::NRZI_4B5B)
+			mcs.rate = m_code_rate.load();
+		m_link_rate.store(mcs.rate);
+		return mcs;
+	}
+
+	// synth_loop only: a data frame goes out again. Reports only come with frames that got through
+	// at least as far as their header, a loss steps down for get_mcs_loss_hold() frames whatever
+	// they say; not out of OFDM though, NRZI is no more robust against noise and less so against
+	// echoes, only a report takes the link there
+	void on_resend()
+	{
+		if (!m_link_adaptation.load() || m_loss_hold > 0 || m_link_step <= 1)
+			return;
+		m_loss_ceiling = m_link_step - 1;
+		m_link_step = m_loss_ceiling;
+		m_link_rate.store(mcs_steps[m_link_step].rate);
+		m_loss_hold = config.get_mcs_loss_hold();
+	}
+
+	// * FrameStream sizes: ACK (all its copies) and SYN frames go into the head whole, data frames
+	// their preamble and PHY header only
+	int max_head_length()
+	{
+		int ack = config.get_max_ack_copies()
+			* frame_length(config.get_link_report_bits() + config.get_lt_report_bits() + config.get_sack_bits());
+		int syn = frame_length(300);
+		return std::max(ack, syn);
+	}
+
+	// MAC header and payload of a data frame, rate 1/2 has the most
+	int max_line_bits()
+	{
+		const int limit = config.get_phy_frame_payload_symbol_limit();
+		return 32 + config.get_header_crc().width() + payload_bits(limit, CodeRate::R1_2);
+	}
+
+	int fixed_ack_length() { return 4 * frame_length(50); }
+
+	// * audio thread side
+
+	void wake_synth()
+	{
+		m_synth_signal.fetch_add(1, std::memory_order_release);
+		m_synth_signal.notify_one();
+	}
+
+	// false if the request ring is full: nothing changes, the caller asks again next callback
+	bool request(SignalKind kind, int64_t ack = Protocol_Control::NO_ACK)
+	{
+		if (!m_requests.push(SynthRequest { kind, ack }))
+			return false;
+		if (kind != SignalKind::DATA)
+			m_waiting = true;
+		wake_synth();
+		return true;
+	}
+
+	// dropped if the logger falls behind
+	void log(const char* format, int value)
+	{
+		m_log_events.push(LogEvent { format, value });
+		wake_synth();
+	}
+
+	void sent(int seq)
+	{
+		m_sent.push(SentEvent { seq, control.clock.load() });
+		wake_synth();
+	}
+
+	void release_slot(int slot)
+	{
+		if (slot < 0)
+			return;
+		m_released.push(slot);
+		wake_synth();
+	}
+
+	void load_signal(int slot)
+	{
+		release_slot(m_signal_slot);
+		m_signal_slot = slot;
+	}
+
+	// * the frame on air; an empty one (nothing rendered yet) is done at once
+	FrameStream<T>& current_frame() { return m_signal_slot < 0 ? m_no_frame : m_frames[m_signal_slot]; }
+
+	void collect_rendered()
+	{
+		Rendered rendered;
+		while (m_rendered.pop(std::span<Rendered>(&rendered, 1))) {
+			if (rendered.kind == SignalKind::DATA) {
+				m_data_requested = false;
+				m_ready_data = rendered;
+			} else {
+				load_signal(rendered.slot);
+				m_waiting = false;
 			}
 		}
-		for (int i = frame.size() - config.get_crc_residual_length(); i < frame.size(); ++i)
-			saved_frame.push_back(frame[i]);
-		frame = std::move(saved_frame);
 	}
 
-	void append_silence(Signal& signal) { append_vec(m_silence, signal); }
+	// next frame of the window, if synth_loop has it ready
+	bool take_data()
+	{
+		if (m_ready_data.slot < 0) {
+			if (!m_data_requested && request(SignalKind::DATA)) {
+				m_data_requested = true;
+				m_timer_woken = false;
+			}
+			return false;
+		}
+		load_signal(m_ready_data.slot);
+		cur_ack = m_ready_data.ack;
+		m_data_seq = m_ready_data.seq;
+		m_ready_data.slot = -1;
+		has_packet = true;
+		return true;
+	}
 
-	template <typename U> void append_vec(const std::vector<U>& from, std::vector<U>& to)
+	// * synth thread side
+
+	void synth_loop()
 	{
-		std::copy(std::begin(from), std::end(from), std::back_inserter(to));
+		std::vector<int> free_slots;
+		for (int i = 0; i < NUM_SIGNALS; ++i)
+			free_slots.push_back(i);
+
+		// data frame asked for by the audio thread, rendered once the window has one
+		bool data_requested = false;
+		// last frame handed out, kept for re-rendering with a newer ACK
+		std::shared_ptr<PHY_Unit> packet;
+
+		while (running.load()) {
+			uint32_t signal = m_synth_signal.load(std::memory_order_acquire);
+			bool progress = false;
+
+			LogEvent event;
+			while (m_log_events.pop(std::span<LogEvent>(&event, 1))) {
+				config.log(std::vformat(event.format, std::make_format_args(event.value)));
+				progress = true;
+			}
+
+			SentEvent sent;
+			while (m_sent.pop(std::span<SentEvent>(&sent, 1))) {
+				m_sender_window.on_sent(sent.seq, sent.clock);
+				progress = true;
+			}
+
+			int free_slot;
+			while (m_released.pop(std::span<int>(&free_slot, 1))) {
+				free_slots.push_back(free_slot);
+				progress = true;
+			}
+
+			while (m_requests.size()) {
+				SynthRequest request = m_requests[0];
+				bool needs_slot = request.kind != SignalKind::DATA;
+				if (needs_slot && free_slots.empty())
+					break;
+				m_requests.discard(1);
+				progress = true;
+
+				if (request.kind == SignalKind::DATA) {
+					data_requested = true;
+				} else {
+					free_slot = free_slots.back();
+					free_slots.pop_back();
+					auto& target = m_frames[free_slot];
+					if (request.kind == SignalKind::REMODULATE) {
+						modulate(target, packet->frame, packet->seq, request.ack, packet->aggregate);
+					} else {
+						// whole in the head
+						target.clear();
+						if (request.kind == SignalKind::ACK)
+							gen_ack(target.head(), request.ack);
+						else
+							gen_syn(target.head());
+					}
+					m_rendered.push(Rendered { request.kind, free_slot, request.ack });
+				}
+			}
+
+			if (data_requested && free_slots.size() && m_sender_window.consume_one(packet, control.clock.load())) {
+				free_slot = free_slots.back();
+				free_slots.pop_back();
+				int64_t ack = control.ack.load();
+				if (packet->retries)
+					on_resend();
+				modulate(m_frames[free_slot], packet->frame, packet->seq, ack, packet->aggregate);
+				m_rendered.push(Rendered { SignalKind::DATA, free_slot, ack, packet->seq });
+				data_requested = false;
+				progress = true;
+			}
+
+			if (!progress) {
+				m_synth_seen.store(signal, std::memory_order_release);
+				m_synth_signal.wait(signal, std::memory_order_acquire);
+			}
+		}
 	}
 
 private:
 	Config& config;
+	const LineCode& line_code;
 	SenderSlidingWindow& m_sender_window;
 	Protocol_Control& control;
 
 	enum class PhySendState { PROCESS_FRAME, SEND_SIGNAL, INVALID_STATE };
 	PhySendState state;
 	SyncQueue<Frame> m_send_queue;
+	// send_loop only
+	Frame m_held;
+	bool m_has_held = false;
 	std::thread worker;
 	std::atomic_bool running;
 	RingBuffer<std::shared_ptr<PHY_Unit>> m_send_buffer;
 	RingBuffer<std::shared_ptr<PHY_Unit>> m_resend_buffer;
 
 	Signal m_silence = Signal(10);
-	int start;
-	std::shared_ptr<PHY_Unit> packet;
-	Signal signal;
+	bool has_packet = false;
+
+	std::atomic_int m_self_id = -1;
+	std::atomic<Modulation> m_modulation { config.get_phy_modulation() };
+	std::atomic<CodeRate> m_code_rate { config.get_phy_code_rate() };
+	std::atomic_bool m_link_adaptation { config.get_phy_link_adaptation() };
+	// synth_loop only, the mcs_steps index of the last data frame; at most m_loss_ceiling for the
+	// next m_loss_hold frames
+	int m_link_step = 0;
+	int m_loss_ceiling = 0;
+	int m_loss_hold = 0;
+	// its code rate, for send_loop to aggregate up to
+	std::atomic<CodeRate> m_link_rate { config.get_phy_code_rate() };
+	// synth_loop only
+	ConvolutionalCode m_fec;
+	WaveformCache<T> m_waveforms { 512 * frame_length(0) };
+
+	std::thread synth_worker;
+	std::atomic<uint32_t> m_synth_signal { 0 };
+	// last m_synth_signal synth_loop went to sleep on
+	std::atomic<uint32_t> m_synth_seen { UINT32_MAX };
+	std::vector<FrameStream<T>> m_frames;
+	FrameStream<T> m_no_frame { 0, 0 };
+	// audio thread -> synth_loop
+	RingBuffer<SynthRequest> m_requests;
+	RingBuffer<int> m_released;
+	RingBuffer<LogEvent> m_log_events;
+	RingBuffer<SentEvent> m_sent;
+	// synth_loop -> audio thread
+	RingBuffer<Rendered> m_rendered;
+
+	// * audio thread only
+	// slot on air / next data frame
+	int m_signal_slot = -1;
+	Rendered m_ready_data { SignalKind::DATA, -1, Protocol_Control::NO_ACK };
+	// seq of the data frame loaded
+	int m_data_seq = -1;
+	bool m_data_requested = false;
+	bool m_timer_woken = false;
+	bool m_waiting = false;
+	std::minstd_rand m_random;
+	// clock the ACK not yet sent has been waiting since, -1 if none
+	int m_ack_since = -1;
+	MAC_Stats m_stats;
+	// a padded ACK sent 4 times, as they used to go out
+	const int m_fixed_ack_length = fixed_ack_length();
+
+	// * CSMA / ACK state of pop_stream, one set per node
+	int counter = 0;
+	int hold_channel = 0;
+	int trying_channel = 0;
+	int jammed = 0;
+	int slot = 16;
+	int backoff = 1;
+	int64_t last_ack = Protocol_Control::NO_ACK;
+	int64_t cur_ack = Protocol_Control::NO_ACK;
+	int syn_issued = 0;
+	int syn_sent = 0;
+	int ack_flying = 0;
+	// the ACK requested has an LT report to take along
+	int report_flying = 0;
+	int continuous_sent = 0;
 };
 }
@@ -1,11 +1,14 @@
 #pragma once
 
+#include "BitBuffer.hpp"
 #include "Config.hpp"
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 
 namespace Athernet {
 
-using Frame = std::vector<int>;
+using Frame = BitBuffer;
 
 struct MacFrame {
 
@@ -27,28 +30,39 @@ struct MacFrame {
 	{
 		assert(frame.size() >= 32);
 
-		for (int i = 0; i < 4; ++i) {
-			to += frame[i] << i;
-		}
-
-		for (int i = 0; i < 4; ++i) {
-			from += frame[i + 4] << i;
-		}
-
-		for (int i = 0; i < 8; ++i) {
-			seq += frame[i + 8] << i;
-		}
-		for (int i = 0; i < 8; ++i) {
-			ack += frame[i + 16] << i;
-		}
+		to = static_cast<int>(frame.extract(0, 4));
+		from = static_cast<int>(frame.extract(4, 4));
+		seq = static_cast<int>(frame.extract(8, 8));
+		ack = static_cast<int>(frame.extract(16, 8));
 
 		has_ack = frame[24];
 		is_ack = frame[25];
 		is_syn = frame[26];
+		has_sack = frame[27];
+		is_aggregate = frame[28];
+		has_report = frame[31];
 		if (!bad_data) {
-			for (int i = 32 + 8; i < frame.size(); ++i) {
-				data.push_back(frame[i]);
+			data = frame.slice(32 + 8, frame.size());
+			// link report first, then the payload proper
+			int report_bits = Config::get_instance().get_link_report_bits();
+			if (has_report && data.size() >= report_bits) {
+				report = static_cast<int>(data.extract(0, report_bits));
+				data = data.slice(report_bits, data.size());
+			}
+			// ACK frames: LT completion report (control_section bit 4, see MAC_Sender::gen_ack), then
+			// the SACK bitmap, cut after its last set bit
+			auto& config = Config::get_instance();
+			has_lt_report = is_ack && is_aggregate && data.size() >= config.get_lt_report_bits();
+			if (has_lt_report) {
+				const int transfer_bits = config.get_lt_transfer_bits();
+				lt_transfer = static_cast<int>(data.extract(0, transfer_bits));
+				lt_chunk = static_cast<int>(data.extract(transfer_bits, config.get_lt_chunk_bits()));
+				lt_last = data[config.get_lt_report_bits() - 1];
+				data = data.slice(config.get_lt_report_bits(), data.size());
 			}
+			int sack_bits = std::min(Config::get_instance().get_sack_bits(), data.size());
+			if (has_sack && sack_bits)
+				sack = static_cast<uint32_t>(data.extract(0, sack_bits));
 		}
 	}
 	int from;
@@ -58,8 +72,21 @@ struct MacFrame {
 	int is_ack;
 	int has_ack;
 	int is_syn;
+	int has_sack = 0;
+	int is_aggregate = 0;
+	uint32_t sack = 0;
+	int has_report = 0;
+	// dB, the peer's measurement of our last frame (Protocol_Control::peer_snr)
+	int report = -1;
+	// dB, as the PHY measured this frame (see FrameExtractor::snr_db)
+	int snr = 0;
+	// the peer decoded lt_chunk of lt_transfer, or all of it (see LT_Decode::set_on_report)
+	int has_lt_report = 0;
+	int lt_transfer = 0;
+	int lt_chunk = 0;
+	int lt_last = 0;
 	int bad_data;
-	std::vector<int> data;
+	Frame data;
 };
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+
+#ifdef WIN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Athernet {
+
+// Read only memory map of a whole file, pages come in as they are touched
+class MappedFile {
+public:
+	explicit MappedFile(const std::string& path)
+	{
+#ifdef WIN
+		m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (m_file == INVALID_HANDLE_VALUE)
+			return;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_file, &size))
+			return;
+		m_size = static_cast<size_t>(size.QuadPart);
+		m_valid = true;
+		if (!m_size)
+			return;
+		m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!m_mapping) {
+			m_valid = false;
+			return;
+		}
+		m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+		m_valid = m_data != nullptr;
+#else
+		m_fd = open(path.c_str(), O_RDONLY);
+		if (m_fd < 0)
+			return;
+		struct stat st;
+		if (fstat(m_fd, &st))
+			return;
+		m_size = static_cast<size_t>(st.st_size);
+		m_valid = true;
+		if (!m_size)
+			return;
+		void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+		if (data == MAP_FAILED) {
+			m_valid = false;
+			return;
+		}
+		madvise(data, m_size, MADV_SEQUENTIAL);
+		m_data = static_cast<const uint8_t*>(data);
+#endif
+	}
+
+	~MappedFile()
+	{
+#ifdef WIN
+		if (m_data)
+			UnmapViewOfFile(m_data);
+		if (m_mapping)
+			CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE)
+			CloseHandle(m_file);
+#else
+		if (m_data)
+			munmap(const_cast<uint8_t*>(m_data), m_size);
+		if (m_fd >= 0)
+			close(m_fd);
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool valid() const { return m_valid; }
+
+	size_t size() const { return m_size; }
+
+	std::span<const uint8_t> bytes() const { return { m_data, m_size }; }
+
+private:
+	const uint8_t* m_data = nullptr;
+	size_t m_size = 0;
+	bool m_valid = false;
+
+#ifdef WIN
+	HANDLE m_file = INVALID_HANDLE_VALUE;
+	HANDLE m_mapping = nullptr;
+#else
+	int m_fd = -1;
+#endif
+};
+
+}
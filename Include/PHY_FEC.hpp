@@ -0,0 +1,161 @@
+#pragma once
+
+#include "BitBuffer.hpp"
+#include "Config.hpp"
+#include "DSP_Kernels.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace Athernet {
+
+// Payload FEC: the K = 7 convolutional code of 802.11 (generators 133, 171 octal), punctured to
+// rate 2/3 or 3/4; 6 zero tail bits take the encoder back to state 0.
+// The decoder is a soft input Viterbi decoder, one value per coded bit: positive for a 0, the larger
+// the surer, 0 for nothing known (punctured bits). Scratch buffers inside, one instance per thread.
+class ConvolutionalCode {
+public:
+	static constexpr int NUM_STATES = 64;
+	static constexpr int TAIL_BITS = 6;
+
+	ConvolutionalCode()
+		: kernels { DSP_Kernels::get_instance() }
+	{
+		// * state: the last 6 input bits, newest in bit 0. Into state n from n / 2 the register is n
+		// itself, from n / 2 + 32 only the oldest bit differs, both generators take it: the outputs flip
+		for (int n = 0; n < NUM_STATES; ++n) {
+			m_sign0[n] = parity(n & G0) ? -1.0f : 1.0f;
+			m_sign1[n] = parity(n & G1) ? -1.0f : 1.0f;
+		}
+	}
+
+	// coded bits of num_bits, tail included
+	static int coded_bits(int num_bits, CodeRate rate)
+	{
+		auto keep = pattern(rate);
+		const int mother = 2 * (num_bits + TAIL_BITS);
+		const int period = static_cast<int>(keep.size());
+		int ret = 0;
+		for (int k = 0; k < period; ++k)
+			ret += keep[k] * ((mother - k + period - 1) / period);
+		return ret;
+	}
+
+	// most bits whose coded_bits() are at most num_coded
+	static int max_bits(int num_coded, CodeRate rate)
+	{
+		auto keep = pattern(rate);
+		const int period = static_cast<int>(keep.size());
+		const int kept = static_cast<int>(std::count(std::begin(keep), std::end(keep), 1));
+		int ret = num_coded * (period / 2) / kept - TAIL_BITS + 1;
+		while (ret > 0 && coded_bits(ret, rate) > num_coded)
+			--ret;
+		return std::max(ret, 0);
+	}
+
+	// appends coded_bits(bits.size(), rate) bits to out
+	void encode(const BitBuffer& bits, CodeRate rate, BitBuffer& out) const
+	{
+		auto keep = pattern(rate);
+		const int period = static_cast<int>(keep.size());
+		int state = 0;
+		int k = 0;
+		for (int i = 0; i < bits.size() + TAIL_BITS; ++i) {
+			int reg = state << 1 | (i < bits.size() ? bits[i] : 0);
+			for (int g : { G0, G1 }) {
+				if (keep[k])
+					out.push_back(parity(reg & g));
+				k = (k + 1) % period;
+			}
+			state = reg & (NUM_STATES - 1);
+		}
+	}
+
+	// soft: coded_bits(num_bits, rate) values, appends num_bits decisions to out
+	void decode(std::span<const float> soft, int num_bits, CodeRate rate, BitBuffer& out)
+	{
+		assert(static_cast<int>(soft.size()) >= coded_bits(num_bits, rate));
+		auto keep = pattern(rate);
+		const int period = static_cast<int>(keep.size());
+		const int steps = num_bits + TAIL_BITS;
+		if (static_cast<int>(m_decisions.size()) < steps)
+			m_decisions.resize(steps);
+
+		// the encoder starts in state 0
+		float* metrics = m_metrics[0].data();
+		float* next = m_metrics[1].data();
+		std::fill(metrics, metrics + NUM_STATES, UNREACHABLE);
+		metrics[0] = 0;
+
+		int pos = 0;
+		int k = 0;
+		auto next_soft = [&] {
+			float s = keep[k] ? soft[pos++] : 0.0f;
+			k = (k + 1) % period;
+			return s;
+		};
+		for (int t = 0; t < steps; ++t) {
+			float s0 = next_soft();
+			float s1 = next_soft();
+			m_decisions[t] = kernels.viterbi_step(std::span<const float, NUM_STATES>(metrics, NUM_STATES),
+				std::span<float, NUM_STATES>(next, NUM_STATES), m_sign0, m_sign1, s0, s1);
+			std::swap(metrics, next);
+			// keep the metrics near 0, only their differences matter
+			if (t % 64 == 63) {
+				float best = *std::max_element(metrics, metrics + NUM_STATES);
+				for (int n = 0; n < NUM_STATES; ++n)
+					metrics[n] -= best;
+			}
+		}
+
+		// * back from state 0, where the tail left the encoder
+		const int begin = out.size();
+		out.resize(begin + num_bits);
+		int state = 0;
+		for (int t = steps - 1; t >= 0; --t) {
+			if (t < num_bits)
+				out.set(begin + t, state & 1);
+			state = state >> 1 | static_cast<int>(m_decisions[t] >> state & 1) << 5;
+		}
+	}
+
+private:
+	static constexpr int G0 = 0133;
+	static constexpr int G1 = 0171;
+	static constexpr float UNREACHABLE = -1e30f;
+
+	static int parity(int x) { return std::popcount(static_cast<unsigned>(x)) & 1; }
+
+	// which bits of the mother code (pairs of the two generators, in order) are sent, one period
+	static std::span<const uint8_t> pattern(CodeRate rate)
+	{
+		static constexpr uint8_t RATE_1_2[] = { 1, 1 };
+		static constexpr uint8_t RATE_2_3[] = { 1, 1, 1, 0 };
+		static constexpr uint8_t RATE_3_4[] = { 1, 1, 1, 0, 0, 1 };
+		switch (rate) {
+		case CodeRate::R2_3:
+			return RATE_2_3;
+		case CodeRate::R3_4:
+			return RATE_3_4;
+		default:
+			assert(rate == CodeRate::R1_2);
+			return RATE_1_2;
+		}
+	}
+
+	const DSP_Kernels& kernels;
+
+	std::array<float, NUM_STATES> m_sign0;
+	std::array<float, NUM_STATES> m_sign1;
+
+	// * decoder
+	std::array<std::array<float, NUM_STATES>, 2> m_metrics;
+	// bit n of step t: state n came from n / 2 + 32
+	std::vector<uint64_t> m_decisions;
+};
+
+}
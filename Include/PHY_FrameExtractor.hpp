@@ -1,26 +1,55 @@
+#include "BitBuffer.hpp"
 #include "Config.hpp"
+#include "DSP_Kernels.hpp"
+#include "PHY_FEC.hpp"
+#include "PHY_LineCode.hpp"
+#include "PHY_OFDM.hpp"
+#include "PHY_PreambleDetector.hpp"
 #include "Protocol_Control.hpp"
 #include "RingBuffer.hpp"
 #include "SyncQueue.hpp"
+#include <algorithm>
 #include <atomic>
+#include <cmath>
+#include <span>
 #include <thread>
 #include <vector>
 
 namespace Athernet {
+
+// counters of the receive path, readable from any thread
+struct PHY_Stats {
+	std::atomic_int preambles = 0;
+	std::atomic_int good = 0;
+	std::atomic_int bad_length = 0;
+	std::atomic_int bad_header = 0;
+	std::atomic_int bad_payload = 0;
+};
+
 template <typename T> class FrameExtractor {
 	using SoftUInt64 = std::pair<uint32_t, uint32_t>;
-	using Bits = std::vector<int>;
-	using Frame = std::vector<int>;
+	using Bits = BitBuffer;
 
 public:
 	FrameExtractor(Athernet::RingBuffer<T>& recv_buffer, Athernet::SyncQueue<MacFrame>& recv_queue,
-		Athernet::SyncQueue<Frame>& decoder_queue, Protocol_Control& mac_control)
+		Protocol_Control& mac_control)
 		: config { Athernet::Config::get_instance() }
+		, kernels { Athernet::DSP_Kernels::get_instance() }
+		, line_code { Athernet::LineCode::get_instance() }
 		, m_recv_buffer { recv_buffer }
 		, m_recv_queue { recv_queue }
-		, m_decoder_queue { decoder_queue }
 		, control { mac_control }
+		, m_carrier_dot_products(config.get_num_carriers())
 	{
+		m_preamble_to_ofdm = config.get_ofdm_rms() * config.get_ofdm_rms() * config.get_preamble_length()
+			/ config.get_preamble_energy(Tag<float>());
+		for (const auto& carrier : config.get_carriers(Tag<float>())) {
+			m_carrier_ptrs.push_back(carrier[0].data());
+		}
+		// the longest payload: rate 1/2
+		m_llrs.reserve(header_crc_end()
+			+ ConvolutionalCode::coded_bits(
+				config.get_phy_frame_payload_symbol_limit() + config.get_payload_crc().width(), CodeRate::R1_2));
 		running.store(true);
 		start = 0;
 		worker = std::thread(&FrameExtractor::frame_extract_loop, this);
@@ -31,11 +60,16 @@ public:
 	{
 		std::cerr << "Called\n";
 		running.store(false);
+		m_recv_buffer.shutdown();
 		worker.join();
 		std::cerr << "End\n";
-		m_recv_buffer.dump("received.txt");
+		if constexpr (Athernet::DUMP_RECEIVED) {
+			m_recv_buffer.dump("received.txt");
+		}
 	};
 
+	const PHY_Stats& get_stats() const { return m_stats; }
+
 private:
 	double to_double(SoftUInt64 x) { return (double)((((unsigned long long)x.first) << 32) + x.second); }
 
@@ -43,6 +77,10 @@ private:
 
 	void frame_extract_loop()
 	{
+		const bool fft_preamble = std::is_floating_point<T>::value
+			&& config.get_preamble_length() >= Athernet::PREAMBLE_DETECTOR_FFT_MIN_LENGTH;
+		// samples the preamble search needs from an offset on
+		const int search_length = fft_preamble ? m_preamble_detector.lookahead() : config.get_preamble_length();
 		T max_val = 0;
 		int max_pos = -1;
 		int saved_start = 0;
@@ -50,25 +88,34 @@ private:
 		PhyRecvState next_state = PhyRecvState::INVALID_STATE;
 		Bits length;
 		Bits bits;
-		int received = 0;
-		int good = 0;
 		while (running.load()) {
 			if (state == PhyRecvState::WAIT_HEADER) {
-				if (start > m_recv_buffer.size() - config.get_preamble_length()) {
-					std::this_thread::yield();
+				if (start > m_recv_buffer.size() - search_length) {
+					m_recv_buffer.wait_for_size(start + search_length);
 					continue;
 				}
 
 				bool confirmed = false;
-				for (int i = start, buffer_size = m_recv_buffer.size();
-					 i <= buffer_size - config.get_preamble_length(); ++i, ++start) {
+				for (int i = start, buffer_size = m_recv_buffer.size(); i <= buffer_size - search_length;
+					 ++i, ++start) {
 					T dot_product = 0;
 					T received_energy = 0;
-					for (int j = 0; j < config.get_preamble_length(); ++j) {
-						dot_product += mul_small(
-							m_recv_buffer[i + j], config.get_preamble(Athernet::Tag<T>())[j], Tag<T>());
+					if constexpr (std::is_floating_point<T>::value) {
+						if (fft_preamble) {
+							m_preamble_detector.correlate(m_recv_buffer, i, buffer_size, dot_product, received_energy);
+						} else {
+							auto samples = window(i, config.get_preamble_length());
+							dot_product = kernels.dot(samples, config.get_preamble(Tag<float>()));
+							received_energy = kernels.energy(samples);
+						}
+					} else {
+						for (int j = 0; j < config.get_preamble_length(); ++j) {
+							dot_product += mul_small(
+								m_recv_buffer[i + j], config.get_preamble(Athernet::Tag<T>())[j], Tag<T>());
 
-						received_energy += mul_small(m_recv_buffer[i + j], m_recv_buffer[i + j], Tag<T>());
+							received_energy
+								+= mul_small(m_recv_buffer[i + j], m_recv_buffer[i + j], Tag<T>());
+						}
 					}
 
 					if (dot_product < 0)
@@ -108,8 +155,13 @@ private:
 					}
 				}
 				if (confirmed) {
-					received++;
+					m_stats.preambles++;
+					int lead = std::min(max_pos, PreambleDetector::SNR_LEAD);
+					m_snr = m_preamble_detector.snr(window(max_pos - lead, config.get_preamble_length()))
+						* m_preamble_to_ofdm;
 					m_recv_buffer.discard(max_pos + config.get_preamble_length());
+					m_preamble_detector.reset();
+					m_levels = {};
 					// std::cerr << "head>  " << m_recv_buffer.show_head() << "\n";
 					start = 0;
 					saved_start = 0;
@@ -120,16 +172,20 @@ private:
 					if (max_pos != -1) {
 						// discard everything until max_pos
 						m_recv_buffer.discard(max_pos);
+						m_preamble_detector.shift(max_pos);
 						start -= max_pos;
 						max_pos = 0;
 					} else {
 						m_recv_buffer.discard(start);
+						m_preamble_detector.shift(start);
 						start = 0;
 					}
 				}
 			} else if (state == PhyRecvState::GET_LENGTH) {
 				bits.clear();
-				symbols_to_collect = config.get_phy_frame_length_num_bits();
+				m_llrs.clear();
+				m_modulation = Modulation::NRZI_4B5B;
+				symbols_to_collect = config.get_phy_frame_length_num_bits() + config.get_phy_frame_code_num_bits();
 				start += 2;
 				state = PhyRecvState::COLLECT_BITS;
 				next_state = PhyRecvState::GET_PAYLOAD;
@@ -139,14 +195,15 @@ private:
 
 				// move to length
 				std::swap(length, bits);
-				int payload_length = 0;
-				for (int i = 0; i < length.size(); ++i) {
-					if (length[i])
-						payload_length += (1 << i);
-				}
+				int payload_length = static_cast<int>(length.extract(0, config.get_phy_frame_length_num_bits()));
+				int code = static_cast<int>(
+					length.extract(config.get_phy_frame_length_num_bits(), config.get_phy_frame_code_num_bits()));
+				m_code_rate = static_cast<CodeRate>(code & 3);
 				// std::cerr << "Length: " << payload_length << "\n";
 				// discard bad frame
-				if (payload_length > config.get_phy_frame_payload_symbol_limit() || payload_length < 32) {
+				if (payload_length > config.get_phy_frame_payload_symbol_limit() || payload_length < 32
+					|| code != (code & 3) * 5) {
+					m_stats.bad_length++;
 					state = PhyRecvState::WAIT_HEADER;
 					// restore start
 					start = saved_start;
@@ -157,9 +214,13 @@ private:
 				}
 
 				bits.clear();
+				m_llrs.clear();
+				m_crc_pos = 0;
 				// collect data and crc residual
-				symbols_to_collect
-					= payload_length + config.get_crc_residual_length() + config.get_crc_residual_length();
+				m_payload_bits = payload_length - 32 + config.get_payload_crc().width();
+				symbols_to_collect = header_crc_end()
+					+ (m_code_rate == CodeRate::NONE ? m_payload_bits
+													 : ConvolutionalCode::coded_bits(m_payload_bits, m_code_rate));
 
 				start += 2;
 				state = PhyRecvState::COLLECT_BITS;
@@ -168,49 +229,68 @@ private:
 				// for (auto x : bits)
 				// 	std::cerr << x;
 				// std::cerr << "\n";
-				if (crc_check(bits, 0, 32 + config.get_crc_residual_length())) {
-					// good header
-					if (crc_check(bits, 32 + config.get_crc_residual_length(), bits.size())) {
-						// good to go
-						for (int i = 0; i < config.get_crc_residual_length(); ++i) {
-							bits.pop_back();
-						}
-						good++;
-
-						// dispatch normal frame to recv_queue, and coded frame to decoder_queue
-						if (!bits[bits.size() - 1]) {
-							bits.pop_back();
-							MacFrame frame(bits, 0);
-							m_recv_queue.push(std::move(frame));
-
-						} else {
-							bits.pop_back();
-							m_decoder_queue.push(std::move(bits));
-						}
-					} else {
-						// discard
-						// std::cerr << "                                    ";
-						// std::cerr << "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!Bad"
-						// 			 "frame!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n";
-						MacFrame frame(bits, 1);
-						m_recv_queue.push(std::move(frame));
-						start = saved_start;
-					}
+				// header CRC is already verified by update_crc() while collecting
+				if (m_code_rate != CodeRate::NONE)
+					decode_payload(bits);
+				m_payload_crc = config.get_payload_crc().update(m_payload_crc, bits, m_crc_pos, bits.size());
+				if (m_payload_crc == 0) {
+					// good to go
+					bits.resize(bits.size() - config.get_payload_crc().width());
+					m_stats.good++;
+
+					// coded flag stays at the end, frames are acked alike and split up after the MAC window
+					MacFrame frame(bits, 0);
+					frame.snr = snr_db();
+					m_recv_queue.push(std::move(frame));
 				} else {
+					// discard
 					// std::cerr << "                                    ";
 					// std::cerr << "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!Bad"
 					// 			 "frame!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n";
+					m_stats.bad_payload++;
+					MacFrame frame(bits, 1);
+					frame.snr = snr_db();
+					m_recv_queue.push(std::move(frame));
 					start = saved_start;
 				}
+				control.ofdm_on_air.store(false);
 
 				state = PhyRecvState::WAIT_HEADER;
 			} else if (state == PhyRecvState::COLLECT_BITS) {
 				if (!symbols_to_collect) {
 					state = next_state;
 				} else {
-					symbols_to_collect -= to_bits_4b5b(symbols_to_collect, bits);
-					if (symbols_to_collect) {
-						std::this_thread::yield();
+					int count = symbols_to_collect;
+					// * the payload may be OFDM, nothing past the header goes through the 4B5B
+					// demodulator before its CRC has been checked
+					if (next_state == PhyRecvState::CHECK_PAYLOAD && m_crc_pos < header_crc_end())
+						count = std::min(count, header_crc_end() - bits.size());
+					if (m_modulation == Modulation::NRZI_4B5B) {
+						symbols_to_collect -= to_bits_4b5b(count, bits);
+					} else {
+						symbols_to_collect -= to_bits_ofdm(count, bits);
+					}
+
+					int bits_wanted = symbols_to_collect;
+					if (next_state == PhyRecvState::CHECK_PAYLOAD) {
+						if (!update_crc(bits)) {
+							// bad header, don't wait for the payload
+							m_stats.bad_header++;
+							start = saved_start;
+							state = PhyRecvState::WAIT_HEADER;
+							continue;
+						}
+						if (m_crc_pos < header_crc_end()) {
+							bits_wanted = std::min(bits_wanted, header_crc_end() - bits.size());
+						}
+					}
+					if (symbols_to_collect && m_modulation != Modulation::NRZI_4B5B) {
+						// next OFDM symbol
+						m_recv_buffer.wait_for_size(start + m_ofdm.symbol_length());
+					} else if (symbols_to_collect) {
+						// sleep until the rest of the field (or a full view) has arrived
+						int symbols = std::min((bits_wanted + 3) / 4, (config.get_max_view_length() - 2) / 10);
+						m_recv_buffer.wait_for_size(start + symbols * 10);
 					}
 				}
 			} else if (state == PhyRecvState::INVALID_STATE) {
@@ -221,28 +301,68 @@ private:
 
 		if constexpr (Athernet::DUMP_RECEIVED) {
 			std::cerr << "--------[FrameExtractor]--------\n";
-			std::cerr << "     Received:      " << received << "\n";
-			std::cerr << "     Bad:           " << received - good << "\n";
+			std::cerr << "     Received:      " << m_stats.preambles << "\n";
+			std::cerr << "     Bad:           " << m_stats.preambles - m_stats.good << "\n";
 		}
 	}
 
-	bool crc_check(Bits bits, int start, int end)
+	// * quality of the frame just collected, dB at the level of an OFDM payload so all frames
+	// compare: the EVM of an OFDM payload, else from the preamble
+	int snr_db() const
 	{
-		for (int i = start; i < end - config.get_crc_residual_length(); ++i) {
-			if (bits[i]) {
-				for (int j = 0; j < config.get_crc_length(); ++j) {
-					bits[i + j] ^= config.get_crc()[j];
-				}
-			}
+		double snr = m_modulation == Modulation::NRZI_4B5B ? m_snr : m_ofdm.snr();
+		return static_cast<int>(std::lround(10 * log10(std::max(snr, 1e-3))));
+	}
+
+	// MAC header (32 bits) + its CRC
+	int header_crc_end() { return 32 + config.get_header_crc().width(); }
+
+	// check the header CRC once it has arrived, then feed whole words of payload into the running
+	// payload CRC, false if the header is bad
+	bool update_crc(const Bits& bits)
+	{
+		if (m_crc_pos < header_crc_end()) {
+			if (bits.size() < header_crc_end())
+				return true;
+			if (!config.get_header_crc().check(bits, 0, header_crc_end()))
+				return false;
+			m_crc_pos = header_crc_end();
+			m_payload_crc = 0;
+			// control_section bits 5 - 6
+			m_modulation = static_cast<Modulation>(bits[29] | bits[30] << 1);
+			if (m_modulation > Modulation::OFDM_16QAM)
+				return false;
+			m_ofdm.reset();
+			control.ofdm_on_air.store(m_modulation != Modulation::NRZI_4B5B);
 		}
+		// a coded payload has its CRC checked once decoded
+		if (m_code_rate != CodeRate::NONE)
+			return true;
+		int end = m_crc_pos + (bits.size() - m_crc_pos) / 64 * 64;
+		m_payload_crc = config.get_payload_crc().update(m_payload_crc, bits, m_crc_pos, end);
+		m_crc_pos = end;
+		return true;
+	}
 
-		bool is_zero = true;
-		for (int i = end - config.get_crc_residual_length(); i < end; ++i) {
-			if (bits[i]) {
-				is_zero = false;
-			}
+	// coded payload after the MAC header and its CRC -> payload and payload CRC, in place
+	void decode_payload(Bits& bits)
+	{
+		const int begin = header_crc_end();
+		bits.resize(begin);
+		m_fec.decode(std::span<const float>(m_llrs).subspan(begin), m_payload_bits, m_code_rate, bits);
+	}
+
+	// contiguous buffer window [offset, offset + count)
+	std::span<const float> window(int offset, int count)
+	{
+		if constexpr (std::is_same<T, float>::value) {
+			return m_recv_buffer.view(offset, count);
+		} else {
+			if (static_cast<int>(m_window.size()) < count)
+				m_window.resize(count);
+			m_recv_buffer.copy_to(m_window.data(), offset, count);
+			return { m_window.data(), static_cast<size_t>(count) };
 		}
-		return is_zero;
 	}
 
 	int to_bits(int count, Bits& bits)
@@ -254,17 +374,31 @@ private:
 		for (int i = start; i < rightmost_pos && converted_count < count;
 			 i += config.get_phy_frame_CP_length() + config.get_symbol_length(),
 				 start += config.get_phy_frame_CP_length() + config.get_symbol_length()) {
-			for (const auto& carrier : config.get_carriers(Tag<T>())) {
-				T dot_product = 0;
-				for (int j = 0; j < config.get_symbol_length(); ++j) {
-					dot_product += mul_small(
-						m_recv_buffer[i + config.get_phy_frame_CP_length() + j], carrier[0][j], Tag<T>());
+			if constexpr (std::is_floating_point<T>::value) {
+				kernels.multi_dot(window(i + config.get_phy_frame_CP_length(), config.get_symbol_length()),
+					m_carrier_ptrs, m_carrier_dot_products);
+			} else {
+				for (int k = 0; k < config.get_num_carriers(); ++k) {
+					const auto& carrier = config.get_carriers(Tag<T>())[k];
+					T dot_product = 0;
+					for (int j = 0; j < config.get_symbol_length(); ++j) {
+						dot_product += mul_small(
+							m_recv_buffer[i + config.get_phy_frame_CP_length() + j], carrier[0][j], Tag<T>());
+					}
+					m_carrier_dot_products[k] = dot_product;
 				}
+			}
+			for (auto dot_product : m_carrier_dot_products)
+				m_levels.add(static_cast<double>(dot_product));
+			// BPSK: LLR 2 a y / sigma^2
+			const double scale = 2 * m_levels.scale();
+			for (auto dot_product : m_carrier_dot_products) {
 				if (dot_product > 0) {
 					bits.push_back(0);
 				} else {
 					bits.push_back(1);
 				}
+				m_llrs.push_back(static_cast<float>(scale * static_cast<double>(dot_product)));
 				if (++converted_count >= count)
 					break;
 			}
@@ -273,32 +407,40 @@ private:
 		return converted_count;
 	}
 
-	int to_bits_4b5b(int count, Bits& bits)
+	int to_bits_ofdm(int count, Bits& bits)
 	{
-		// std::cerr << "In -> \n";
-		int rightmost_pos = m_recv_buffer.size() - 9;
+		const int length = m_ofdm.symbol_length();
 		int converted_count = 0;
-		for (int i = start; i < rightmost_pos && converted_count < count; i += 10, start += 10) {
-			float val[6] = { m_recv_buffer[i - 2] + m_recv_buffer[i - 1],
-				m_recv_buffer[i] + m_recv_buffer[i + 1], m_recv_buffer[i + 2] + m_recv_buffer[i + 3],
-				m_recv_buffer[i + 4] + m_recv_buffer[i + 5], m_recv_buffer[i + 6] + m_recv_buffer[i + 7],
-				m_recv_buffer[i + 8] + m_recv_buffer[i + 9] };
-			int y = 0;
-			for (int j = 0; j < 5; ++j) {
-				y += (int)(val[j] * val[j + 1] < 0) << j;
-			}
-			int x = config.get_map_5b_4b(y);
-			for (int j = 0; j < 4; ++j) {
-				bits.push_back((x >> j) & 1);
-				++converted_count;
-				if (converted_count >= count)
-					break;
-			}
+		while (converted_count < count && start + length <= m_recv_buffer.size()) {
+			converted_count
+				+= m_ofdm.demodulate(window(start, length), m_modulation, count - converted_count, bits, m_llrs);
+			start += length;
 		}
-		// std::cerr << " <- Out\n";
 		return converted_count;
 	}
 
+	int to_bits_4b5b(int count, Bits& bits)
+	{
+		// symbol at i spans [i - 2, i + 10), 2 samples per NRZI level
+		int available = (m_recv_buffer.size() - start) / 10;
+		int needed = (count + 3) / 4;
+		int viewable = (config.get_max_view_length() - 2) / 10;
+		int num_symbols = std::min({ available, needed, viewable });
+		if (num_symbols <= 0)
+			return 0;
+
+		int num_sums = num_symbols * 5 + 1;
+		if (static_cast<int>(m_sums.size()) < num_sums)
+			m_sums.resize(num_sums);
+		kernels.pair_sums(window(start - 2, num_sums * 2), std::span<float>(m_sums.data(), num_sums));
+		start += num_symbols * 10;
+		for (int i = 0; i < num_sums; ++i)
+			m_levels.add(m_sums[i]);
+		const float scale = static_cast<float>(m_levels.scale());
+
+		return line_code.demodulate(std::span<const float>(m_sums.data(), num_sums), scale, count, bits, m_llrs);
+	}
+
 	int mul_small(int x, int y)
 	{
 
@@ -436,11 +578,65 @@ private:
 	};
 
 	Athernet::Config& config;
+	const Athernet::DSP_Kernels& kernels;
+	const Athernet::LineCode& line_code;
 	Athernet::RingBuffer<T>& m_recv_buffer;
 	Athernet::SyncQueue<MacFrame>& m_recv_queue;
-	Athernet::SyncQueue<Frame>& m_decoder_queue;
 	Protocol_Control& control;
 
+	// incremental CRC over bits[0, m_crc_pos)
+	int m_crc_pos = 0;
+	uint32_t m_payload_crc = 0;
+
+	PreambleDetector m_preamble_detector;
+
+	// payload of the frame being collected, from its MAC header
+	Modulation m_modulation = Modulation::NRZI_4B5B;
+	OFDM m_ofdm;
+	// preamble SNR of the frame, scaled by m_preamble_to_ofdm: OFDM power / preamble power
+	double m_snr = 0;
+	double m_preamble_to_ofdm = 0;
+	// from the PHY header: payload code, payload + CRC bits before coding
+	CodeRate m_code_rate = CodeRate::NONE;
+	int m_payload_bits = 0;
+	ConvolutionalCode m_fec;
+
+	// * soft output: log-likelihood ratio of every bit in bits (positive for a 0), reserved for the
+	// longest frame up front
+	std::vector<float> m_llrs;
+	// |value| of the demodulator outputs of the frame so far, for their noise
+	struct LevelStats {
+		double sum = 0;
+		double squares = 0;
+		int count = 0;
+
+		void add(double x)
+		{
+			sum += std::abs(x);
+			squares += x * x;
+			++count;
+		}
+
+		// a / sigma^2 of values +-a + noise, 40 dB at most
+		double scale() const
+		{
+			if (!count)
+				return 0;
+			double a = sum / count;
+			double noise = std::max(squares / count - a * a, a * a * 1e-4);
+			return a / std::max(noise, 1e-20);
+		}
+	};
+	LevelStats m_levels;
+
+	// scratch for contiguous windows (non-float T)
+	std::vector<float> m_window;
+	std::vector<float> m_sums;
+	std::vector<const float*> m_carrier_ptrs;
+	std::vector<T> m_carrier_dot_products;
+
+	PHY_Stats m_stats;
+
 	std::thread worker;
 	std::atomic_bool running;
 	int start;
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "BitBuffer.hpp"
+#include "Config.hpp"
+#include "PHY_LineCode.hpp"
+#include "PHY_OFDM.hpp"
+#include <algorithm>
+#include <span>
+#include <vector>
+
+namespace Athernet {
+
+// One frame on its way out, modulated as its samples are read instead of all at once: the head
+// (preamble and PHY header, or a whole control frame) is rendered with the frame, the line after it
+// (MAC header, NRZI payload) is line coded LINE_BLOCK_BITS at a time, an OFDM payload a symbol at a
+// time. Memory is the same whatever the length of the frame.
+// Filled on one thread, read on another, never both at once (MAC_Sender hands it over with its
+// slot); reading doesn't allocate.
+template <typename T> class FrameStream {
+public:
+	// head_capacity: samples, max_bits: of the line and of the payload
+	FrameStream(int head_capacity, int max_bits)
+		: line_code { LineCode::get_instance() }
+	{
+		m_head.reserve(head_capacity);
+		m_line.reserve(max_bits);
+		m_payload.reserve(max_bits);
+		m_block.resize(std::max(LineCode::num_samples(LINE_BLOCK_BITS), m_ofdm.symbol_length()));
+	}
+
+	// * filling
+
+	void clear()
+	{
+		m_head.clear();
+		m_line.clear();
+		m_payload.clear();
+		m_modulation = Modulation::NRZI_4B5B;
+		rewind();
+	}
+
+	// samples before the line, for the caller to append to
+	std::vector<T>& head() { return m_head; }
+
+	// line coded after the head, a line of its own
+	void set_line(const BitBuffer& bits)
+	{
+		m_line.clear();
+		m_line.append(bits);
+	}
+
+	// OFDM symbols after the line
+	void set_payload(const BitBuffer& bits, Modulation modulation)
+	{
+		m_payload.clear();
+		m_payload.append(bits);
+		m_modulation = modulation;
+	}
+
+	// * reading
+
+	int size() const
+	{
+		int size = static_cast<int>(m_head.size());
+		if (m_line.size())
+			size += LineCode::num_samples(m_line.size());
+		if (m_modulation != Modulation::NRZI_4B5B)
+			size += m_ofdm.signal_length(m_payload.size(), m_modulation);
+		return size;
+	}
+
+	bool done() const { return m_position >= size(); }
+
+	// back to the first sample
+	void rewind()
+	{
+		m_position = 0;
+		m_stage = Stage::HEAD;
+		m_next = 0;
+		m_negative = false;
+		m_current = {};
+	}
+
+	// up to count samples into buffer, returns how many
+	int read(float* buffer, int count)
+	{
+		int index = 0;
+		while (index < count && (m_current.size() || next_block())) {
+			int n = std::min(count - index, static_cast<int>(m_current.size()));
+			std::copy_n(m_current.data(), n, buffer + index);
+			m_current = m_current.subspan(n);
+			index += n;
+		}
+		m_position += index;
+		return index;
+	}
+
+private:
+	static constexpr int LINE_BLOCK_BITS = 64;
+
+	enum class Stage { HEAD, LINE, PAYLOAD, END };
+
+	// the samples after m_current into it, false at the end of the frame
+	bool next_block()
+	{
+		switch (m_stage) {
+		case Stage::HEAD:
+			m_current = m_head;
+			m_stage = Stage::LINE;
+			return true;
+		case Stage::LINE: {
+			if (m_next >= m_line.size()) {
+				m_next = 0;
+				m_stage = Stage::PAYLOAD;
+				return true;
+			}
+			const int end = std::min(m_next + LINE_BLOCK_BITS, m_line.size());
+			std::span<T> block(m_block);
+			if (m_next == 0) {
+				block = block.first(LineCode::num_samples(end));
+				line_code.modulate(m_line, 0, end, block);
+			} else {
+				block = block.first(LineCode::num_samples(end - m_next) - LineCode::SAMPLES_PER_LEVEL);
+				line_code.modulate_continued(m_line, m_next, end, block, m_negative);
+			}
+			m_negative = block.back() < 0;
+			m_next = end;
+			m_current = block;
+			return true;
+		}
+		case Stage::PAYLOAD:
+			if (m_modulation == Modulation::NRZI_4B5B || m_next >= m_ofdm.num_symbols(m_payload.size(), m_modulation)) {
+				m_stage = Stage::END;
+				return false;
+			}
+			{
+				std::span<T> block = std::span<T>(m_block).first(m_ofdm.symbol_length());
+				m_ofdm.modulate_symbol(m_payload, m_modulation, m_next++, block);
+				m_current = block;
+			}
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	const LineCode& line_code;
+	OFDM m_ofdm;
+
+	std::vector<T> m_head;
+	BitBuffer m_line;
+	BitBuffer m_payload;
+	Modulation m_modulation = Modulation::NRZI_4B5B;
+
+	// * reader
+	int m_position = 0;
+	Stage m_stage = Stage::HEAD;
+	// line: next bit, payload: next symbol
+	int m_next = 0;
+	// the line's last level
+	bool m_negative = false;
+	std::vector<T> m_block;
+	// what is left of the block (or the head) being read
+	std::span<const T> m_current;
+};
+
+}
@@ -33,20 +33,26 @@ public:
 		}
 
 		control.collision.store(false);
+		// * only while we are sending: a receiver holds back what it hears on a collision, it would
+		// keep doing so on a loud frame after a quiet one and never see the end of the quiet one
+		const float threshold = control.ofdm_on_air.load() && m_sender.transmitting()
+			? config.get_ofdm_collision_threshold()
+			: config.get_collision_threshold();
 		for (int i = windows_size; i < numSamples; ++i) {
 			sum += inputChannelData[0][i] * inputChannelData[0][i] * inputChannelData[0][i]
 				* inputChannelData[0][i];
 			sum -= inputChannelData[0][i - windows_size] * inputChannelData[0][i - windows_size]
 				* inputChannelData[0][i - windows_size] * inputChannelData[0][i - windows_size];
-			if (sum / windows_size > config.get_collision_threshold()) {
+			if (sum / windows_size > threshold) {
 				control.collision.store(true);
 				break;
 			}
 		}
 		sum = 0;
 		control.busy.store(false);
+		const float sense = config.get_carrier_sense_threshold();
 		for (int i = 0; i < numSamples; ++i) {
-			if (fabs(inputChannelData[0][i]) > 0.01)
+			if (fabs(inputChannelData[0][i]) > sense)
 				control.busy.store(true);
 		}
 
@@ -61,10 +67,43 @@ public:
 
 	virtual void audioDeviceStopped() override { }
 
-	void send_frame(const std::vector<int>& frame) { m_sender.push_frame(frame); }
+	void send_frame(const std::vector<int>& frame) { m_sender.push_frame(BitBuffer(frame)); }
+
+	void send_frame(const BitBuffer& frame) { m_sender.push_frame(frame); }
 
 	std::vector<std::vector<int>> get_frames() { }
 
+	// frames waiting for a place in the sender window
+	int queued_frames() { return m_sender.queued_frames(); }
+
+	// per node address, for several nodes in one process (see SimulatedChannel)
+	void set_self_id(int id)
+	{
+		m_sender.set_self_id(id);
+		m_receiver.set_self_id(id);
+	}
+
+	// payload modulation of the data frames sent on this link
+	void set_modulation(Modulation modulation) { m_sender.set_modulation(modulation); }
+
+	// convolutional code of the data frames sent on this link
+	void set_code_rate(CodeRate rate) { m_sender.set_code_rate(rate); }
+
+	// longest frame send_frame() takes at the code rate set now
+	int max_frame_bits() const { return m_sender.max_frame_bits(); }
+
+	// modulation follows the link (see MAC_Sender::set_link_adaptation)
+	void set_link_adaptation(bool enabled) { m_sender.set_link_adaptation(enabled); }
+
+	// received samples the demodulator has not caught up with yet
+	int pending_samples() { return m_receiver.pending_samples(); }
+
+	// no waveform waiting to be rendered
+	bool synth_idle() const { return m_sender.synth_idle(); }
+
+	// the peer reported chunk of transfer decoded: done() of LT_Send on a real link
+	bool lt_decoded(int transfer, int chunk) { return control.is_lt_decoded(transfer, chunk); }
+
 	~PHY_Layer() { }
 
 private:
@@ -0,0 +1,168 @@
+#pragma once
+
+#include "BitBuffer.hpp"
+#include "Config.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace Athernet {
+
+// 4B5B + NRZI line code of the PHY header, the MAC header and NRZI payloads: every 4 bits (LSB
+// first, zero padded) become a 5 bit code word, every code bit 1 is a level change, a level is
+// SAMPLES_PER_LEVEL samples of +-1. One level +1 goes first, the reference for the first change.
+// Both ways work a byte (two code words, 10 levels) at a time off tables; the level is carried
+// across bytes as a mask XORed into the table entry.
+class LineCode {
+public:
+	static constexpr int SAMPLES_PER_LEVEL = 2;
+
+	// Singleton
+	static const LineCode& get_instance()
+	{
+		static LineCode instance;
+		return instance;
+	}
+
+	// samples of num_bits, the leading level included
+	static int num_samples(int num_bits) { return SAMPLES_PER_LEVEL * (1 + (num_bits + 3) / 4 * 5); }
+
+	// writes num_samples(bits.size()) samples to out
+	template <typename T> void modulate(const BitBuffer& bits, std::span<T> out) const
+	{
+		modulate(bits, 0, bits.size(), out);
+	}
+
+	// bits [begin, end) as a line of their own: num_samples(end - begin) samples; begin and end on
+	// whole bytes but for the end of bits
+	template <typename T> void modulate(const BitBuffer& bits, int begin, int end, std::span<T> out) const
+	{
+		assert(static_cast<int>(out.size()) >= num_samples(end - begin));
+		std::fill_n(out.data(), SAMPLES_PER_LEVEL, static_cast<T>(1));
+		modulate_continued(bits, begin, end, out.subspan(SAMPLES_PER_LEVEL), false);
+	}
+
+	// bits right after others on the same line (whole code words), from its last level: the samples
+	// of modulate() without the leading level, negated if that level is -1
+	template <typename T> void modulate_continued(const BitBuffer& bits, std::span<T> out, bool negative) const
+	{
+		modulate_continued(bits, 0, bits.size(), out, negative);
+	}
+
+	template <typename T>
+	void modulate_continued(const BitBuffer& bits, int begin, int end, std::span<T> out, bool negative) const
+	{
+		assert(static_cast<int>(out.size()) >= num_samples(end - begin) - SAMPLES_PER_LEVEL);
+		// * zero padding comes from reading past the end of bits
+		assert(begin % 8 == 0 && ((end - begin) % 8 == 0 || end == bits.size()));
+		T* p = out.data();
+		// 0x3FF while the level is -1
+		uint32_t flip = negative ? 0x3FF : 0;
+		int pos = begin;
+		for (; pos + 4 < end; pos += 8) {
+			uint32_t levels = m_encode[bits.extract(pos, 8)] ^ flip;
+			p = std::copy_n(m_samples[levels & 31], 5 * SAMPLES_PER_LEVEL, p);
+			p = std::copy_n(m_samples[levels >> 5], 5 * SAMPLES_PER_LEVEL, p);
+			flip = (0 - (levels >> 9 & 1)) & 0x3FF;
+		}
+		// one code word left
+		if (pos < end)
+			std::copy_n(m_samples[(m_encode[bits.extract(pos, 4)] ^ flip) & 31], 5 * SAMPLES_PER_LEVEL, p);
+	}
+
+	// levels: one value per level, the one before the first code word included (5 per code word + 1),
+	// scale: a / sigma^2 of levels +-a + noise; appends up to max_bits data bits to bits and their
+	// log-likelihood ratios to llrs (positive for a 0), returns how many
+	int demodulate(std::span<const float> levels, float scale, int max_bits, BitBuffer& bits,
+		std::vector<float>& llrs) const
+	{
+		const int num_words = (static_cast<int>(levels.size()) - 1) / 5;
+		int converted = 0;
+		for (int w = 0; w < num_words && converted < max_bits; w += 2) {
+			const float* v = levels.data() + w * 5;
+			const int n = std::min(2, num_words - w);
+			// * signs of the levels, a code bit 1 where two neighbours differ; without a second code word
+			// the high half decodes to garbage that isn't taken
+			uint32_t signs = 0;
+			for (int j = 0; j <= 5 * n; ++j)
+				signs |= static_cast<uint32_t>(v[j] < 0) << j;
+			uint32_t changes = (signs ^ signs >> 1) & ((1u << 5 * n) - 1);
+			const int take = std::min(4 * n, max_bits - converted);
+			bits.append(m_decode[changes], take);
+			for (int k = 0; k < take; k += 4)
+				soft_decode(v + k / 4 * 5, scale, std::min(4, take - k), llrs);
+			converted += take;
+		}
+		return converted;
+	}
+
+private:
+	LineCode()
+	{
+		auto& config = Config::get_instance();
+		for (int x = 0; x < 256; ++x) {
+			uint32_t code = config.get_map_4b_5b(x & 15) | config.get_map_4b_5b(x >> 4) << 5;
+			// level k: the changes up to k, from +1
+			uint32_t levels = 0, level = 0;
+			for (int k = 0; k < 10; ++k) {
+				level ^= code >> k & 1;
+				levels |= level << k;
+			}
+			m_encode[x] = static_cast<uint16_t>(levels);
+		}
+		for (int x = 0; x < 32; ++x) {
+			for (int k = 0; k < 5 * SAMPLES_PER_LEVEL; ++k)
+				m_samples[x][k] = x >> (k / SAMPLES_PER_LEVEL) & 1 ? -1.0f : 1.0f;
+		}
+		// * not a code word: all ones, as before the tables
+		for (int x = 0; x < 1024; ++x) {
+			m_decode[x] = static_cast<uint8_t>((config.get_map_5b_4b(x & 31) & 15) | (config.get_map_5b_4b(x >> 5) & 15) << 4);
+		}
+		for (int x = 0; x < 16; ++x)
+			m_code[x] = static_cast<uint8_t>(config.get_map_4b_5b(x));
+	}
+
+	// one code word, levels v[0 .. 5]: LLRs of its first num_bits data bits
+	void soft_decode(const float* v, float scale, int num_bits, std::vector<float>& llrs) const
+	{
+		// * max-log LLR of a level change (code bit 1) between levels +-a: a / sigma^2 *
+		// (|v1 - v2| - |v1 + v2|), scale goes on at the end. The log-likelihood of a code word is
+		// then, up to a constant, the sum over its changes: all 32 sums, 16 of them code words
+		float sums[32];
+		sums[0] = 0;
+		for (int j = 0; j < 5; ++j) {
+			float change = std::abs(v[j] - v[j + 1]) - std::abs(v[j] + v[j + 1]);
+			for (int x = 0; x < 1 << j; ++x)
+				sums[x | 1 << j] = sums[x] + change;
+		}
+		float scores[16];
+		for (int w = 0; w < 16; ++w)
+			scores[w] = sums[m_code[w]];
+		// data bit LLRs from the best word either way
+		for (int j = 0; j < num_bits; ++j) {
+			float zero = -FLT_MAX, one = -FLT_MAX;
+			for (int w = 0; w < 16; ++w) {
+				if (!(w >> j & 1)) {
+					zero = std::max(zero, scores[w]);
+					one = std::max(one, scores[w | 1 << j]);
+				}
+			}
+			llrs.push_back(scale * (zero - one));
+		}
+	}
+
+	// byte -> its 10 levels from +1, LSB first (1 for -1)
+	uint16_t m_encode[256];
+	// 5 levels -> their samples
+	float m_samples[32][5 * SAMPLES_PER_LEVEL];
+	// 10 code bits -> byte
+	uint8_t m_decode[1024];
+	// 4 bits -> code word
+	uint8_t m_code[16];
+};
+
+}
@@ -0,0 +1,304 @@
+#pragma once
+
+#include "BitBuffer.hpp"
+#include "Config.hpp"
+#include "FFT.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <span>
+#include <vector>
+
+namespace Athernet {
+
+// OFDM payload of a data frame: a training symbol, then data symbols until the bits run out.
+// A symbol is get_ofdm_cp_length() samples of cyclic prefix + get_ofdm_fft_size() samples, real
+// valued (Hermitian spectrum), on get_ofdm_num_subcarriers() subcarriers from
+// get_ofdm_first_subcarrier() up. Every get_ofdm_pilot_spacing()th subcarrier is a pilot, the
+// others carry Gray coded QPSK / 16-QAM points, LSB first, whitened: zeros or any other repeating
+// pattern would add up to peaks that get clipped.
+// The training symbol (known BPSK on every subcarrier) gives the channel of each subcarrier; the
+// pilots of every data symbol give the phase / gain drift since (clock offset), fitted as a line
+// over frequency, and the channel follows it. Scratch buffers inside, one instance per thread.
+class OFDM {
+	using Complex = std::complex<double>;
+
+public:
+	OFDM()
+		: config { Config::get_instance() }
+		, m_fft_size { config.get_ofdm_fft_size() }
+		, m_cp_length { config.get_ofdm_cp_length() }
+		, m_first { config.get_ofdm_first_subcarrier() }
+		, m_fft(m_fft_size)
+		, m_spectrum(m_fft_size)
+		, m_time(m_fft_size)
+		, m_channel(config.get_ofdm_num_subcarriers())
+		, m_drift(config.get_ofdm_num_subcarriers())
+		, m_errors(config.get_ofdm_num_subcarriers())
+	{
+		const int num_subcarriers = config.get_ofdm_num_subcarriers();
+		const int spacing = config.get_ofdm_pilot_spacing();
+		assert(m_first > 0 && m_first + num_subcarriers < m_fft_size / 2);
+		assert(m_cp_length <= m_fft_size);
+
+		// pseudo random signs keep the peaks of the training symbol down
+		uint32_t lfsr = 0xACE1;
+		for (int i = 0; i < num_subcarriers; ++i) {
+			m_training.push_back(lfsr & 1 ? -1.0 : 1.0);
+			m_whitening.push_back(lfsr >> 1 & 15);
+			lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & 0xB400);
+			(i % spacing == spacing / 2 ? m_pilots : m_data).push_back(i);
+		}
+
+		m_phases.reserve(m_pilots.size());
+
+		// RMS of a symbol with unit power on n subcarriers (and their mirror images) is sqrt(2n) / N
+		m_scale = config.get_ofdm_rms() * m_fft_size / sqrt(2.0 * num_subcarriers);
+	}
+
+	static int bits_per_point(Modulation modulation) { return modulation == Modulation::OFDM_16QAM ? 4 : 2; }
+
+	int bits_per_symbol(Modulation modulation) const
+	{
+		return static_cast<int>(m_data.size()) * bits_per_point(modulation);
+	}
+
+	// samples per symbol, cyclic prefix included
+	int symbol_length() const { return m_cp_length + m_fft_size; }
+
+	// symbols of a payload of num_bits, training symbol included
+	int num_symbols(int num_bits, Modulation modulation) const
+	{
+		int per_symbol = bits_per_symbol(modulation);
+		return 1 + (num_bits + per_symbol - 1) / per_symbol;
+	}
+
+	// samples of a payload of num_bits, training symbol included
+	int signal_length(int num_bits, Modulation modulation) const
+	{
+		return num_symbols(num_bits, modulation) * symbol_length();
+	}
+
+	// symbol k of the payload bits, 0 the training symbol: symbol_length() samples to out
+	template <typename T> void modulate_symbol(const BitBuffer& bits, Modulation modulation, int k, std::span<T> out)
+	{
+		clear_spectrum();
+		if (k == 0) {
+			for (int i = 0; i < static_cast<int>(m_training.size()); ++i)
+				set_subcarrier(i, m_training[i]);
+		} else {
+			const int per_point = bits_per_point(modulation);
+			int pos = (k - 1) * bits_per_symbol(modulation);
+			for (int i : m_pilots)
+				set_subcarrier(i, m_training[i]);
+			for (int i : m_data) {
+				// zero padded past the end
+				set_subcarrier(i, map(static_cast<int>(bits.extract(pos, per_point)) ^ m_whitening[i], modulation));
+				pos += per_point;
+			}
+		}
+		write_symbol(out);
+	}
+
+	// next frame, the next symbol is a training symbol again
+	void reset()
+	{
+		m_trained = false;
+		std::fill(std::begin(m_errors), std::end(m_errors), 0.0);
+		m_symbols = 0;
+	}
+
+	// * signal to noise power ratio of the symbols demodulated since reset(), from the distance of
+	// the points to the decisions (EVM) on the weakest subcarrier: without coding its errors are the
+	// frame's errors. Multipath within the cyclic prefix is equalized away and doesn't count, a
+	// subcarrier it fades does
+	double snr() const
+	{
+		if (!m_symbols)
+			return 0;
+		double worst = 0;
+		for (int i : m_data)
+			worst = std::max(worst, m_errors[i]);
+		return m_symbols / std::max(worst, 1e-12);
+	}
+
+	// samples: one symbol, cyclic prefix included; appends up to max_bits hard decisions to bits and
+	// their log-likelihood ratios to llrs (positive for a 0), returns how many (none for the training
+	// symbol)
+	int demodulate(std::span<const float> samples, Modulation modulation, int max_bits, BitBuffer& bits,
+		std::vector<float>& llrs)
+	{
+		assert(static_cast<int>(samples.size()) >= symbol_length());
+		// * the window starts half way into the cyclic prefix: timing off by a few samples either
+		// way is a phase slope over the subcarriers, the same in the training symbol
+		const int offset = m_cp_length / 2;
+		for (int n = 0; n < m_fft_size; ++n)
+			m_spectrum[n] = samples[offset + n];
+		m_fft.forward(m_spectrum);
+
+		if (!m_trained) {
+			for (int i = 0; i < static_cast<int>(m_channel.size()); ++i)
+				m_channel[i] = subcarrier(i) / m_training[i];
+			m_trained = true;
+			return 0;
+		}
+
+		track_pilots();
+
+		const int per_point = bits_per_point(modulation);
+		int converted = 0;
+		float point_llrs[4];
+		for (int i : m_data) {
+			Complex z = subcarrier(i) / (m_channel[i] * m_drift[i]);
+			int x = demap(z, modulation);
+			m_errors[i] += std::norm(z - map(x, modulation));
+			follow(i, map(x, modulation));
+			// * noise of the subcarrier so far, this symbol included, from a prior NOISE_PRIOR
+			const double noise = (m_errors[i] + NOISE_PRIOR) / (m_symbols + 2);
+			soft_demap(z, modulation, 1 / noise, point_llrs);
+			x ^= m_whitening[i];
+			for (int j = 0; j < per_point && converted < max_bits; ++j, ++converted) {
+				bits.push_back((x >> j) & 1);
+				llrs.push_back(m_whitening[i] >> j & 1 ? -point_llrs[j] : point_llrs[j]);
+			}
+		}
+		for (int i : m_pilots)
+			follow(i, m_training[i]);
+		++m_symbols;
+		return converted;
+	}
+
+private:
+	Complex subcarrier(int i) const { return m_spectrum[m_first + i]; }
+
+	void set_subcarrier(int i, Complex x)
+	{
+		m_spectrum[m_first + i] = x;
+		m_spectrum[m_fft_size - m_first - i] = std::conj(x);
+	}
+
+	void clear_spectrum() { std::fill(std::begin(m_spectrum), std::end(m_spectrum), Complex {}); }
+
+	// the spectrum, cyclic prefix first
+	template <typename T> void write_symbol(std::span<T> out)
+	{
+		assert(static_cast<int>(out.size()) >= symbol_length());
+		m_fft.inverse(m_spectrum);
+		for (int n = 0; n < m_fft_size; ++n)
+			m_time[n] = std::clamp(static_cast<float>(m_spectrum[n].real() * m_scale), -1.0f, 1.0f);
+		T* p = std::copy(std::begin(m_time) + m_fft_size - m_cp_length, std::end(m_time), out.data());
+		std::copy(std::begin(m_time), std::end(m_time), p);
+	}
+
+	// * the channel of a subcarrier moves towards what the symbol just decided says it is; it lags
+	// behind a drift a little, the pilots of the symbol make up for that in m_drift
+	void follow(int i, Complex x)
+	{
+		static constexpr double RATE = 0.25;
+		m_channel[i] += RATE * (subcarrier(i) / x - m_channel[i]);
+	}
+
+	// pilots against the channel so far: gain g and phase a + b * i of every subcarrier into m_drift
+	void track_pilots()
+	{
+		double mean_i = 0, mean_phase = 0, gain = 0;
+		for (int i : m_pilots) {
+			Complex ratio = subcarrier(i) / (m_channel[i] * m_training[i]);
+			m_phases.push_back(std::arg(ratio));
+			mean_i += i;
+			mean_phase += m_phases.back();
+			gain += std::abs(ratio);
+		}
+		const double n = static_cast<double>(m_pilots.size());
+		mean_i /= n;
+		mean_phase /= n;
+		gain /= n;
+
+		double num = 0, den = 0;
+		for (size_t p = 0; p < m_pilots.size(); ++p) {
+			num += (m_pilots[p] - mean_i) * (m_phases[p] - mean_phase);
+			den += (m_pilots[p] - mean_i) * (m_pilots[p] - mean_i);
+		}
+		m_phases.clear();
+		const double slope = den > 0 ? num / den : 0;
+
+		for (int i = 0; i < static_cast<int>(m_drift.size()); ++i)
+			m_drift[i] = std::polar(gain, mean_phase + slope * (i - mean_i));
+	}
+
+	static Complex map(int x, Modulation modulation)
+	{
+		if (modulation == Modulation::OFDM_16QAM) {
+			// Gray per axis: 00 -3, 01 -1, 11 +1, 10 +3
+			static constexpr double LEVELS[4] = { -3, -1, 3, 1 };
+			static const double SCALE = 1 / sqrt(10.0);
+			return Complex(LEVELS[x & 3], LEVELS[x >> 2 & 3]) * SCALE;
+		}
+		static const double SCALE = 1 / sqrt(2.0);
+		return Complex(x & 1 ? -1 : 1, x & 2 ? -1 : 1) * SCALE;
+	}
+
+	// max-log LLRs of the bits of point z, before whitening; noise: of z, both axes together
+	static void soft_demap(Complex z, Modulation modulation, double inv_noise, float* llrs)
+	{
+		if (modulation == Modulation::OFDM_16QAM) {
+			static const double SCALE = 1 / sqrt(10.0);
+			// per axis: bit 0 is 1 on the inner levels, bit 1 on the positive ones
+			auto axis = [&](double v, float* out) {
+				double inner = std::abs(v) - 2 * SCALE;
+				out[0] = static_cast<float>(4 * SCALE * inner * inv_noise);
+				double d = std::abs(v) > 2 * SCALE ? 2 * v - 2 * SCALE * (v > 0 ? 1 : -1) : v;
+				out[1] = static_cast<float>(-4 * SCALE * d * inv_noise);
+			};
+			axis(z.real(), llrs);
+			axis(z.imag(), llrs + 2);
+			return;
+		}
+		static const double SCALE = 1 / sqrt(2.0);
+		llrs[0] = static_cast<float>(4 * SCALE * z.real() * inv_noise);
+		llrs[1] = static_cast<float>(4 * SCALE * z.imag() * inv_noise);
+	}
+
+	static int demap(Complex z, Modulation modulation)
+	{
+		if (modulation == Modulation::OFDM_16QAM) {
+			static const double THRESHOLD = 2 / sqrt(10.0);
+			auto axis = [](double v) { return (std::abs(v) < THRESHOLD) | (v > 0) << 1; };
+			return axis(z.real()) | axis(z.imag()) << 2;
+		}
+		return (z.real() < 0) | (z.imag() < 0) << 1;
+	}
+
+	Config& config;
+
+	int m_fft_size;
+	int m_cp_length;
+	int m_first;
+	double m_scale;
+
+	FFT m_fft;
+	std::vector<Complex> m_spectrum;
+	std::vector<float> m_time;
+
+	// subcarrier indices, 0 .. get_ofdm_num_subcarriers() - 1
+	std::vector<int> m_pilots;
+	std::vector<int> m_data;
+	// BPSK of the training symbol, also the pilot values
+	std::vector<double> m_training;
+	// XORed into the point of each subcarrier
+	std::vector<int> m_whitening;
+
+	// * demodulator
+	bool m_trained = false;
+	std::vector<Complex> m_channel;
+	std::vector<Complex> m_drift;
+	std::vector<double> m_phases;
+	// squared error of the points per subcarrier, data symbols
+	std::vector<double> m_errors;
+	int m_symbols = 0;
+	// noise of a subcarrier before its first symbol, 20 dB
+	static constexpr double NOISE_PRIOR = 0.01;
+};
+
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+#include "Config.hpp"
+#include "FFT.hpp"
+#include "RingBuffer.hpp"
+#include <cmath>
+#include <complex>
+#include <span>
+#include <vector>
+
+namespace Athernet {
+
+// Streaming preamble correlator (overlap-save FFT).
+// A block of N samples gives N - L + 1 correlation values against the preamble,
+// the next block starts right after the last one and re-reads L - 1 samples.
+// Received energy of each window is kept as a running sum inside the block.
+// Blocks are only computed whole (see lookahead()) and survive the buffer head moving (see shift()),
+// so every FFT pays for N - L + 1 offsets however few samples the audio callback brings at a time.
+class PreambleDetector {
+	using Complex = std::complex<double>;
+
+public:
+	PreambleDetector()
+		: config { Athernet::Config::get_instance() }
+		, m_preamble_length { config.get_preamble_length() }
+		, m_block_size { block_size_for(m_preamble_length) }
+		, m_fft(m_block_size)
+		, m_kernel(m_block_size)
+		, m_block(m_block_size)
+		, m_samples(m_block_size)
+		, m_dot_product(m_block_size)
+		, m_energy(m_block_size)
+	{
+		// correlation == convolution with the time reversed preamble
+		const auto& preamble = config.get_preamble(Tag<float>());
+		for (int i = 0; i < m_preamble_length; ++i) {
+			m_kernel[m_preamble_length - 1 - i] = preamble[i];
+		}
+		m_fft.forward(m_kernel);
+
+		// Gram matrix of the delayed preambles over the rows snr() fits, Cholesky factored
+		const int rows_begin = SNR_TAPS - 1;
+		m_gram.assign(SNR_TAPS * SNR_TAPS, 0);
+		for (int j = 0; j < SNR_TAPS; ++j) {
+			for (int k = 0; k <= j; ++k) {
+				double sum = 0;
+				for (int n = rows_begin; n < m_preamble_length; ++n)
+					sum += preamble[n - j] * preamble[n - k];
+				m_gram[j * SNR_TAPS + k] = sum;
+			}
+		}
+		// * the preamble is band limited, delays of it are nearly dependent; a little ridge keeps
+		// the factorization away from zero pivots
+		const double ridge = 1e-6 * config.get_preamble_energy(Tag<float>());
+		for (int j = 0; j < SNR_TAPS; ++j) {
+			for (int k = 0; k <= j; ++k) {
+				double sum = m_gram[j * SNR_TAPS + k] + (j == k ? ridge : 0);
+				for (int m = 0; m < k; ++m)
+					sum -= m_gram[j * SNR_TAPS + m] * m_gram[k * SNR_TAPS + m];
+				m_gram[j * SNR_TAPS + k] = j == k ? sqrt(sum) : sum / m_gram[k * SNR_TAPS + k];
+			}
+		}
+	}
+
+	// samples before the correlation peak snr() wants, they catch an early path / a fractional delay
+	static constexpr int SNR_LEAD = 2;
+
+	// signal to noise power ratio of a received preamble, samples: L of them from up to SNR_LEAD
+	// before the correlation peak.
+	// * least squares fit of SNR_TAPS delayed preambles, what they don't explain is noise: a
+	// fractional delay or a short echo is part of the channel, not noise, unlike in the correlation
+	double snr(std::span<const float> samples)
+	{
+		assert(static_cast<int>(samples.size()) >= m_preamble_length);
+		const auto& preamble = config.get_preamble(Tag<float>());
+		const int rows_begin = SNR_TAPS - 1;
+
+		double taps[SNR_TAPS];
+		for (int k = 0; k < SNR_TAPS; ++k) {
+			double sum = 0;
+			for (int n = rows_begin; n < m_preamble_length; ++n)
+				sum += samples[n] * preamble[n - k];
+			taps[k] = sum;
+		}
+		double total = 0;
+		for (int n = rows_begin; n < m_preamble_length; ++n)
+			total += samples[n] * samples[n];
+
+		// explained energy c^T G^-1 c = |L^-1 c|^2
+		double explained = 0;
+		for (int j = 0; j < SNR_TAPS; ++j) {
+			double sum = taps[j];
+			for (int m = 0; m < j; ++m)
+				sum -= m_gram[j * SNR_TAPS + m] * taps[m];
+			taps[j] = sum / m_gram[j * SNR_TAPS + j];
+			explained += taps[j] * taps[j];
+		}
+
+		const int rows = m_preamble_length - rows_begin;
+		double noise = std::max(total - explained, 1e-12 * total) / (rows - SNR_TAPS);
+		return explained / rows / noise;
+	}
+
+	// invalidate cached block, e.g. once the samples after a preamble are taken
+	void reset()
+	{
+		m_begin = 0;
+		m_count = 0;
+	}
+
+	// the buffer head moved count samples on, the cached block moves with it
+	void shift(int count) { m_begin -= count; }
+
+	// samples correlate() needs from x on: a whole block
+	int lookahead() const { return m_block_size; }
+
+	// dot product with the preamble & energy of window [x, x + L), x + lookahead() <= buffer_size
+	template <typename T>
+	void correlate(RingBuffer<T>& buffer, int x, int buffer_size, float& dot_product, float& received_energy)
+	{
+		if (x < m_begin || x >= m_begin + m_count) {
+			compute_block(buffer, x, buffer_size);
+		}
+		dot_product = m_dot_product[x - m_begin];
+		received_energy = m_energy[x - m_begin];
+	}
+
+private:
+	static int block_size_for(int preamble_length)
+	{
+		int size = 1;
+		while (size < 4 * preamble_length)
+			size <<= 1;
+		return size;
+	}
+
+	template <typename T> void compute_block(RingBuffer<T>& buffer, int x, int buffer_size)
+	{
+		int available = std::min(m_block_size, buffer_size - x);
+		assert(available >= m_preamble_length);
+
+		buffer.copy_to(m_samples.data(), x, available);
+		for (int i = 0; i < available; ++i) {
+			m_block[i] = m_samples[i];
+		}
+		for (int i = available; i < m_block_size; ++i) {
+			m_block[i] = 0;
+		}
+
+		m_fft.forward(m_block);
+		for (int i = 0; i < m_block_size; ++i) {
+			m_block[i] = FFT::mul(m_block[i], m_kernel[i]);
+		}
+		m_fft.inverse(m_block);
+
+		m_begin = x;
+		m_count = available - m_preamble_length + 1;
+
+		double block_energy = 0;
+		for (int i = 0; i < available; ++i) {
+			block_energy += m_samples[i] * m_samples[i];
+		}
+		// FFT rounding error is bounded by eps * log(N) * |block| * |preamble|, anything below that
+		// is a zero dot product (e.g. silence next to a loud block) and must stay zero
+		double tolerance = 1e-12 * sqrt(block_energy * config.get_preamble_energy(Tag<float>()));
+
+		double energy = 0;
+		for (int i = 0; i < m_preamble_length; ++i) {
+			energy += m_samples[i] * m_samples[i];
+		}
+		for (int i = 0; i < m_count; ++i) {
+			// the first L - 1 outputs are wrapped around, drop them
+			double dot_product = m_block[i + m_preamble_length - 1].real();
+			m_dot_product[i] = static_cast<float>(fabs(dot_product) < tolerance ? 0 : dot_product);
+			m_energy[i] = static_cast<float>(std::max(energy, 0.0));
+			if (i + 1 < m_count) {
+				energy += m_samples[i + m_preamble_length] * m_samples[i + m_preamble_length];
+				energy -= m_samples[i] * m_samples[i];
+			}
+		}
+	}
+
+	Config& config;
+
+	static constexpr int SNR_TAPS = 16;
+
+	int m_preamble_length;
+	int m_block_size;
+	FFT m_fft;
+	std::vector<Complex> m_kernel;
+	std::vector<Complex> m_block;
+	std::vector<double> m_samples;
+	std::vector<float> m_dot_product;
+	std::vector<float> m_energy;
+	// snr(): lower triangle, row major
+	std::vector<double> m_gram;
+
+	// cached window offsets [m_begin, m_begin + m_count)
+	int m_begin = 0;
+	int m_count = 0;
+};
+
+}
@@ -1,18 +1,32 @@
 #pragma once
 
-#include <vector>
+#include "BitBuffer.hpp"
+#include <cstdint>
 
 namespace Athernet {
 
 struct PHY_Unit {
-	PHY_Unit(std::vector<int>&& vec, int seq_num)
+	PHY_Unit(BitBuffer&& vec, int seq_num, bool is_aggregate = false)
 		: frame { std::move(vec) }
 		, seq { seq_num }
+		, aggregate { is_aggregate }
 	{
 	}
 
-	std::vector<int> frame;
+	BitBuffer frame;
 	int seq;
+	// frame holds sub-frames, see MAC_Sender::aggregate()
+	bool aggregate;
+
+	// * SenderSlidingWindow bookkeeping, under its mutex
+	bool acked = false;
+	bool sent = false;
+	// Protocol_Control::clock ticks of the last transmission / to resend at
+	int sent_at = 0;
+	int deadline = 0;
+	int retries = 0;
+	// order of the last transmission, tells lost frames from ones still in flight
+	int64_t stamp = 0;
 };
 
-}
\ No newline at end of file
+}
@@ -1,16 +1,118 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
 #include <mutex>
+#include <set>
 #include <vector>
 
 namespace Athernet {
 struct Protocol_Control {
+	// ack: cumulative ACK (-1 before the first frame), the SACK bitmap of the frames after it
+	// (bit i: ack + 2 + i received) and a bit flipped on duplicates so they get ACKed again;
+	// packed so the receiver never publishes half of it
+	static int64_t pack_ack(int ack, uint32_t sack = 0, bool echo = false)
+	{
+		return static_cast<int64_t>(echo) << 56 | static_cast<int64_t>(sack & 0xFFFFFF) << 32 | static_cast<uint32_t>(ack);
+	}
+	static int unpack_ack(int64_t state) { return static_cast<int32_t>(state & 0xFFFFFFFF); }
+	static uint32_t unpack_sack(int64_t state) { return static_cast<uint32_t>(state >> 32) & 0xFFFFFF; }
+	static bool unpack_echo(int64_t state) { return state >> 56 & 1; }
+	static constexpr int64_t NO_ACK = 0xFFFFFFFF;
+
+	// LT completion (see LT_Decode::set_on_report): a chunk of a transfer decoded, or the whole file
+	static int64_t pack_lt_report(int transfer, int chunk, bool last)
+	{
+		return static_cast<int64_t>(last) << 56 | static_cast<int64_t>(transfer & 0xFFFFFF) << 32
+			| static_cast<uint32_t>(chunk);
+	}
+	static int unpack_lt_transfer(int64_t report) { return static_cast<int>(report >> 32 & 0xFFFFFF); }
+	static int unpack_lt_chunk(int64_t report) { return static_cast<int32_t>(report & 0xFFFFFFFF); }
+	static bool unpack_lt_last(int64_t report) { return report >> 56 & 1; }
+	static constexpr int64_t NO_LT_REPORT = -1;
+
 	std::atomic_bool collision = false;
 	std::atomic_bool busy = false;
+	// an OFDM payload is coming in, see Config::get_ofdm_collision_threshold()
+	std::atomic_bool ofdm_on_air = false;
 	std::atomic_int previlege_node = -1;
 	std::atomic_int previlege_duration = 0;
-	std::atomic_int ack = -1;
+	std::atomic<int64_t> ack = NO_ACK;
+	// copies of a standalone ACK sent back to back, more while ours go missing
+	std::atomic_int ack_copies = 2;
+	// dB (see FrameExtractor::snr_db): the last frame of the peer as we measured it, sent back in
+	// our frames; ours as the peer reported it. -1 for nothing yet, a measurement below 0 dB is 0
+	std::atomic_int rx_snr = -1;
+	std::atomic_int peer_snr = -1;
 	std::atomic_bool transmission_start = false;
 	std::atomic_int clock = 0;
+
+	// * ours, for the next ACK frames to take along, one each (see MAC_Sender::gen_ack): chunks
+	// decode on the pool side by side, so several can be waiting
+	void push_lt_report(int64_t report)
+	{
+		std::scoped_lock lock { lt_report_mutex };
+		if (std::find(std::begin(lt_reports), std::end(lt_reports), report) != std::end(lt_reports))
+			return;
+		// a frame of a dropped chunk that still comes in brings it back
+		if (lt_reports.size() >= 64)
+			lt_reports.pop_front();
+		lt_reports.push_back(report);
+		lt_reports_pending.store(static_cast<int>(lt_reports.size()));
+	}
+
+	int64_t pop_lt_report()
+	{
+		if (!has_lt_report())
+			return NO_LT_REPORT;
+		std::scoped_lock lock { lt_report_mutex };
+		if (lt_reports.empty())
+			return NO_LT_REPORT;
+		int64_t report = lt_reports.front();
+		lt_reports.pop_front();
+		lt_reports_pending.store(static_cast<int>(lt_reports.size()));
+		return report;
+	}
+
+	bool has_lt_report() const { return lt_reports_pending.load() > 0; }
+
+	// * the peer's LT reports, chunks decoded per transfer: what LT_Send waits for on a real link
+	// (see PHY_Layer::lt_decoded); the last few transfers only
+	void add_lt_decoded(int64_t report)
+	{
+		const int transfer = unpack_lt_transfer(report);
+		std::scoped_lock lock { lt_mutex };
+		auto it = std::find_if(std::begin(lt_decoded), std::end(lt_decoded),
+			[&](const LT_Decoded& item) { return item.transfer == transfer; });
+		if (it == std::end(lt_decoded)) {
+			if (lt_decoded.size() >= 16)
+				lt_decoded.pop_front();
+			it = lt_decoded.insert(std::end(lt_decoded), LT_Decoded { transfer, {}, false });
+		}
+		it->chunks.insert(unpack_lt_chunk(report));
+		it->all = it->all || unpack_lt_last(report);
+	}
+
+	bool is_lt_decoded(int transfer, int chunk)
+	{
+		std::scoped_lock lock { lt_mutex };
+		return std::any_of(std::begin(lt_decoded), std::end(lt_decoded), [&](const LT_Decoded& item) {
+			return item.transfer == transfer && (item.all || item.chunks.count(chunk));
+		});
+	}
+
+	struct LT_Decoded {
+		int transfer;
+		std::set<int> chunks;
+		bool all = false;
+	};
+	std::mutex lt_mutex;
+	std::deque<LT_Decoded> lt_decoded;
+
+	std::mutex lt_report_mutex;
+	std::deque<int64_t> lt_reports;
+	std::atomic_int lt_reports_pending = 0;
 };
 }
@@ -1,6 +1,8 @@
 #pragma once
 
+#include "BitBuffer.hpp"
 #include "Config.hpp"
+#include <cstdint>
 #include <format>
 #include <vector>
 
@@ -18,25 +20,37 @@ public:
 
 	int get_num_collected() { return collected; }
 
-	void collect(std::vector<std::vector<int>>& file)
+	void collect(std::vector<BitBuffer>& file)
 	{
 		file = std::move(stream);
 		stream.clear();
 		collected = 0;
 	}
 
-	int receive_packet(std::vector<int> packet_payload, int seq)
+	// SACK bitmap for the ACK receive_packet returned: bit i is window_start + 1 + i,
+	// window_start itself is the first frame missing
+	uint32_t get_sack()
+	{
+		uint32_t sack = 0;
+		for (int i = 0; i < config.get_sack_bits() && i + 1 < config.get_max_window_size(); ++i) {
+			if (window[(window_start + 1 + i) % config.get_seq_limit()])
+				sack |= 1u << i;
+		}
+		return sack;
+	}
+
+	int receive_packet(BitBuffer packet_payload, int seq)
 	{
 		bool accepted = false;
-		if (window_start + config.get_window_size() > config.get_seq_limit()) {
+		if (window_start + config.get_max_window_size() > config.get_seq_limit()) {
 			if (seq >= window_start) {
 				accepted = true;
 
-			} else if (seq < window_start + config.get_window_size() - config.get_seq_limit()) {
+			} else if (seq < window_start + config.get_max_window_size() - config.get_seq_limit()) {
 				accepted = true;
 			}
 		} else {
-			if (seq >= window_start && seq < window_start + config.get_window_size()) {
+			if (seq >= window_start && seq < window_start + config.get_max_window_size()) {
 				accepted = true;
 			}
 		}
@@ -49,7 +63,7 @@ public:
 				window[window_start] = 0;
 				// std::copy(std::begin(packets[window_start]), std::end(packets[window_start]),
 				// 	std::back_inserter(stream));
-				stream.push_back(packets[window_start]);
+				stream.push_back(std::move(packets[window_start]));
 
 				collected += 1;
 				if (++window_start >= config.get_seq_limit())
@@ -67,8 +81,8 @@ public:
 private:
 	Config& config;
 	std::vector<int> window;
-	std::vector<std::vector<int>> packets;
-	std::vector<std::vector<int>> stream;
+	std::vector<BitBuffer> packets;
+	std::vector<BitBuffer> stream;
 	int collected = 0;
 	int window_start = 0;
 	int last_received = -1;
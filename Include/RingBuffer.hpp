@@ -1,13 +1,23 @@
 #pragma once
 
 #include "Config.hpp"
+#include <algorithm>
 #include <atomic>
+#include <cstdint>
 #include <set>
+#include <span>
 #include <vector>
 
 namespace Athernet {
 
+constexpr int CACHE_LINE_SIZE = 64;
+
 // SPSC ring buffer
+// Producer owns m_tail / m_write_count, consumer owns m_head / m_read_count, each on its own
+// cache line. Counters only grow; each side publishes its own counter with release and reads the
+// other's with acquire.
+// For arithmetic T the first get_max_view_length() slots are mirrored past the end,
+// so any window up to that length can be read as one contiguous span.
 template <typename T> class RingBuffer {
 
 private:
@@ -25,6 +35,16 @@ private:
 		}
 	}
 
+	// write [pos, pos + count) without wrapping, keep the mirrored tail in sync
+	void write_segment(const T* src, int pos, int count)
+	{
+		std::copy(src, src + count, std::begin(m_data) + pos);
+		if (pos < m_mirror_length) {
+			int mirrored = std::min(count, m_mirror_length - pos);
+			std::copy(src, src + mirrored, std::begin(m_data) + m_capacity + pos);
+		}
+	}
+
 	int head_add_offset(int x)
 	{
 		if (m_head + x >= m_capacity) {
@@ -35,15 +55,20 @@ private:
 	}
 
 public:
-	std::mutex mutex;
 	RingBuffer()
-		: m_capacity(Athernet::Config::get_instance().get_physical_buffer_size())
-		, m_size(0)
-		, m_data(m_capacity)
-		, m_head(0)
-		, m_tail(0)
+		: RingBuffer(Athernet::Config::get_instance().get_physical_buffer_size())
+	{
+	}
 
+	// small hand-over queues between threads
+	explicit RingBuffer(int capacity)
+		: m_capacity(capacity)
+		, m_mirror_length(std::is_arithmetic<T>::value
+				  ? std::min(capacity, Athernet::Config::get_instance().get_max_view_length())
+				  : 0)
+		, m_data(m_capacity + m_mirror_length)
 	{
+		assert(m_mirror_length <= m_capacity);
 	}
 	~RingBuffer() { }
 
@@ -75,70 +100,60 @@ public:
 		fclose(receive_fd);
 	}
 
-	bool push(const std::vector<T>& vec)
+	// * ------------------------------ producer ------------------------------ *
+
+	bool push(const std::vector<T>& vec) { return push(std::span<const T>(vec)); }
+
+	// block write, at most two segments
+	bool push(std::span<const T> src)
 	{
-		int vec_size = static_cast<int>(vec.size());
-		int size_value = m_size.load(std::memory_order_relaxed);
+		int count = static_cast<int>(src.size());
+		int64_t write_count = m_write_count.load(std::memory_order_relaxed);
 
-		if (vec_size > capacity() - size_value) {
+		if (count > m_capacity - static_cast<int>(write_count - m_read_count.load(std::memory_order_acquire))) {
 			return false;
 		}
 
-		for (int i = 0; i < vec_size; ++i) {
-			m_data[m_tail] = vec[i];
-			increment(m_tail);
-		}
+		int first = std::min(count, m_capacity - m_tail);
+		write_segment(src.data(), m_tail, first);
+		write_segment(src.data() + first, 0, count - first);
+		increment_by(m_tail, count);
 
-		m_size.fetch_add(vec_size);
-		return true;
-	}
+		m_write_count.store(write_count + count, std::memory_order_release);
 
-	bool push(const T& val)
-	{
-		int size_value = m_size.load();
-		if (size_value == capacity()) {
-			return false;
+		// wake the consumer once its watermark is reached
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (write_count + count >= m_watermark.load(std::memory_order_relaxed)) {
+			m_signal.fetch_add(1, std::memory_order_release);
+			m_signal.notify_one();
 		}
-		m_data[m_tail] = val;
-		increment(m_tail);
-
-		m_size.fetch_add(1);
-
 		return true;
 	}
 
-	int pop(T* dest, int count)
-	{
-		int size_value = m_size.load(std::memory_order_acquire);
-		int popped_count = size_value < count ? size_value : count;
+	bool push(const T& val) { return push(std::span<const T>(&val, 1)); }
 
-		for (int i = 0; i < popped_count; ++i) {
-			dest[i] = m_data[m_head];
-			increment(m_head);
-		}
-
-		m_size.fetch_sub(popped_count);
+	// * ------------------------------ consumer ------------------------------ *
 
+	// block read, at most two segments
+	int pop(std::span<T> dest)
+	{
+		int popped_count = std::min(size(), static_cast<int>(dest.size()));
+		copy_to(dest.data(), 0, popped_count);
+		release(popped_count);
 		return popped_count;
 	}
 
 	int pop_with_conversion_to_float(float* dest, int count)
 	{
-		int size_value = m_size.load(std::memory_order_acquire);
-		int popped_count = size_value < count ? size_value : count;
-
-		for (int i = 0; i < popped_count; ++i) {
-			if constexpr (std::is_floating_point<T>::value) {
-				dest[i] = m_data[m_head];
-			} else {
-				dest[i] = static_cast<float>(m_data[m_head]) / Athernet::SEND_FLOAT_INT_SCALE;
+		int popped_count = std::min(size(), count);
+		if constexpr (std::is_floating_point<T>::value) {
+			copy_to(dest, 0, popped_count);
+		} else {
+			for (int i = 0; i < popped_count; ++i) {
+				dest[i] = static_cast<float>((*this)[i]) / Athernet::SEND_FLOAT_INT_SCALE;
 			}
-
-			increment(m_head);
 		}
-
-		m_size.fetch_sub(popped_count);
-
+		release(popped_count);
 		return popped_count;
 	}
 
@@ -147,20 +162,68 @@ public:
 		assert(count >= 0);
 		if (!count)
 			return 0;
-		int size_value = m_size.load();
-		int discard_count = size_value < count ? size_value : count;
-		increment_by(m_head, discard_count);
-		m_size.fetch_sub(discard_count);
+		int discard_count = std::min(size(), count);
+		release(discard_count);
 		return discard_count;
 	}
 
-	T& operator[](int x)
+	// copy window [offset, offset + count) to dest, at most two segments
+	template <typename U> void copy_to(U* dest, int offset, int count)
+	{
+		int begin = head_add_offset(offset);
+		int first = std::min(count, m_capacity - begin);
+		std::copy(std::begin(m_data) + begin, std::begin(m_data) + begin + first, dest);
+		std::copy(std::begin(m_data), std::begin(m_data) + (count - first), dest + first);
+	}
+
+	// contiguous window [offset, offset + count), count <= get_max_view_length()
+	std::span<const T> view(int offset, int count)
+	{
+		assert(count <= m_mirror_length);
+		return { m_data.data() + head_add_offset(offset), static_cast<size_t>(count) };
+	}
+
+	const T& operator[](int x)
 	{
 		// no run time check
 		return m_data[head_add_offset(x)];
 	}
 
-	int size() { return m_size.load(); }
+	// block until size() >= count, false if shutdown() was called
+	bool wait_for_size(int count)
+	{
+		int64_t target = m_read_count.load(std::memory_order_relaxed) + count;
+		while (true) {
+			uint32_t signal = m_signal.load(std::memory_order_acquire);
+			if (m_shutdown.load(std::memory_order_acquire)) {
+				break;
+			}
+			m_watermark.store(target, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (m_write_count.load(std::memory_order_relaxed) >= target) {
+				break;
+			}
+			m_signal.wait(signal, std::memory_order_acquire);
+		}
+		m_watermark.store(INT64_MAX, std::memory_order_relaxed);
+		return size() >= count;
+	}
+
+	// release a consumer blocked in wait_for_size()
+	void shutdown()
+	{
+		m_shutdown.store(true, std::memory_order_release);
+		m_signal.fetch_add(1, std::memory_order_release);
+		m_signal.notify_all();
+	}
+
+	// number of readable elements; any thread, e.g. an observer watching the backlog: the read count
+	// is loaded first, so the write count it is taken from is never behind it
+	int size()
+	{
+		int64_t read = m_read_count.load(std::memory_order_acquire);
+		return static_cast<int>(m_write_count.load(std::memory_order_acquire) - read);
+	}
 
 	int capacity() { return m_capacity; }
 
@@ -169,10 +232,30 @@ public:
 	int show_tail() { return m_tail; }
 
 private:
+	void release(int count)
+	{
+		increment_by(m_head, count);
+		m_read_count.store(m_read_count.load(std::memory_order_relaxed) + count, std::memory_order_release);
+	}
+
 	int m_capacity;
-	std::atomic<int> m_size;
-	int m_head;
-	int m_tail;
+	// m_data[m_capacity + i] mirrors m_data[i] for i < m_mirror_length
+	int m_mirror_length;
 	std::vector<T> m_data;
+
+	// consumer side
+	alignas(CACHE_LINE_SIZE) std::atomic<int64_t> m_read_count { 0 };
+	int m_head = 0;
+
+	// wake up when m_write_count reaches m_watermark
+	alignas(CACHE_LINE_SIZE) std::atomic<int64_t> m_watermark { INT64_MAX };
+	std::atomic<uint32_t> m_signal { 0 };
+	std::atomic_bool m_shutdown { false };
+
+	// producer side
+	alignas(CACHE_LINE_SIZE) std::atomic<int64_t> m_write_count { 0 };
+	int m_tail = 0;
+
+	char m_padding[CACHE_LINE_SIZE - sizeof(std::atomic<int64_t>) - sizeof(int)];
 };
 }
@@ -2,7 +2,10 @@
 
 #include "PHY_Unit.hpp"
 #include "RingBuffer.hpp"
+#include <algorithm>
 #include <atomic>
+#include <climits>
+#include <cmath>
 #include <format>
 #include <mutex>
 #include <queue>
@@ -11,12 +14,17 @@ using namespace std::chrono_literals;
 
 namespace Athernet {
 
+// Selective repeat: every frame has its own retransmit timer (in Protocol_Control::clock ticks),
+// ACKs carry a SACK bitmap so only the frames missing on the other side are sent again.
+// The timeout follows the measured RTT (SRTT + 4 RTTVAR, RFC 6298), the window grows by one frame
+// per window ACKed and halves on a loss (AIMD), up to Config::get_max_send_window_size().
 class SenderSlidingWindow {
 public:
 	SenderSlidingWindow()
 		: config { Config::get_instance() }
-		, start { 0 }
 		, window_start { 0 }
+		, m_window { static_cast<double>(config.get_window_size()) }
+		, m_rto { static_cast<double>(config.get_retransmit_timeout()) }
 	{
 	}
 
@@ -32,9 +40,9 @@ public:
 	bool try_push(std::shared_ptr<PHY_Unit> phy_unit)
 	{
 		std::unique_lock lock { mutex };
-		producer.wait_for(lock, 10ms, [&]() { return window.size() < config.get_window_size(); });
+		producer.wait(lock, [&]() { return window.size() < window_limit() || m_shutdown; });
 
-		if (window.size() < config.get_window_size()) {
+		if (window.size() < window_limit()) {
 			window.push(phy_unit);
 			return true;
 		} else {
@@ -42,74 +50,194 @@ public:
 		}
 	}
 
+	// block until try_push() takes a frame right away, false on shutdown
+	bool wait_for_space()
+	{
+		std::unique_lock lock { mutex };
+		producer.wait(lock, [&]() { return window.size() < window_limit() || m_shutdown; });
+		return !m_shutdown;
+	}
+
 	bool empty() { return window.size() == 0; }
 
-	bool consume_one(std::shared_ptr<PHY_Unit>& unit)
+	// next frame to put on air at tick now: the oldest one timed out or lost, else the first one never sent
+	bool consume_one(std::shared_ptr<PHY_Unit>& unit, int now)
 	{
 		std::scoped_lock lock { mutex };
-		if (start < window.size()) {
-			unit = window[start++];
+		for (int i = 0; i < window.size(); ++i) {
+			auto& x = window[i];
+			if (x->acked || (x->sent && now - x->deadline < 0))
+				continue;
+			if (x->sent) {
+				++x->retries;
+				on_loss(*x);
+				config.log(std::format("Resend:  {}", x->seq));
+			}
+			x->sent = true;
+			x->sent_at = now;
+			// * not on air yet (CSMA), the timer proper starts in on_sent()
+			x->deadline = now + config.get_max_retransmit_timeout();
+			x->stamp = ++m_stamp;
+			unit = x;
+			update_deadline();
 			return true;
-		} else {
-			return false;
 		}
+		return false;
 	}
 
-	void remove_acked(int ack)
+	// the frame has left the speaker at tick now
+	void on_sent(int seq, int now)
 	{
 		std::scoped_lock lock { mutex };
-		bool accepted = false;
-		// std::cerr << "Got ack:  " << ack << "   -   " << window_start << "\n";
-		if (window_start + config.get_window_size() > config.get_seq_limit()) {
-			if (ack >= window_start) {
-				accepted = true;
-
-			} else if (ack < window_start + config.get_window_size() - config.get_seq_limit()) {
-				accepted = true;
-				while (window.size() && window_start != 0) {
-					config.log(std::format("Acked:  {},  {}", window[0]->seq, ack));
-					window.discard(1);
-					--start;
-					if (++window_start >= config.get_seq_limit())
-						window_start -= config.get_seq_limit();
-				}
-				if (start < 0)
-					start = 0;
-			}
-		} else {
-			if (ack >= window_start && ack < window_start + config.get_window_size()) {
-				accepted = true;
+		for (int i = 0; i < window.size(); ++i) {
+			auto& x = window[i];
+			if (x->seq != seq || x->acked)
+				continue;
+			x->sent_at = now;
+			x->deadline = now + (static_cast<int>(m_rto) << std::min(x->retries, config.get_max_retransmit_backoff()));
+			update_deadline();
+			return;
+		}
+	}
+
+	// * lock free, for the audio thread: a frame is due for a resend at tick now
+	bool timer_due(int now) const { return now >= m_next_deadline.load(std::memory_order_relaxed); }
+
+	// frames allowed in flight / retransmit timeout in ticks, for the logs
+	double get_window()
+	{
+		std::scoped_lock lock { mutex };
+		return m_window;
+	}
+
+	int get_rto()
+	{
+		std::scoped_lock lock { mutex };
+		return static_cast<int>(m_rto);
+	}
+
+	// ack: cumulative, -1 for none yet; sack bit i: ack + 2 + i received
+	void remove_acked(int ack, uint32_t sack, int now)
+	{
+		std::scoped_lock lock { mutex };
+		const int limit = config.get_seq_limit();
+		int acked = (ack + 1 - window_start + limit) % limit;
+		// * old ACK, the window is at most half the sequence space
+		if (acked > window.size())
+			return;
+		bool removed = acked > 0;
+		for (; acked > 0; --acked)
+			pop_front(now);
+
+		// window[0] is ack + 1, the first frame missing
+		int highest = 0;
+		for (int i = 0; i < config.get_sack_bits() && i + 1 < window.size(); ++i) {
+			if (sack >> i & 1) {
+				if (!window[i + 1]->acked)
+					on_acked(*window[i + 1], now);
+				highest = i + 1;
 			}
 		}
-		if (accepted) {
-			// ! special case: ack = 255,
-			while (window.size() && window[0]->seq < ack) {
-				config.log(std::format("Acked:  {},  {}", window[0]->seq, ack));
-				window.discard(1);
-				--start;
-				if (++window_start >= config.get_seq_limit())
-					window_start -= config.get_seq_limit();
+		// * one channel, nothing overtakes: a hole sent before a SACKed frame is lost, no need to wait
+		for (int i = 0; i < highest; ++i) {
+			auto& x = window[i];
+			if (!x->acked && x->sent && x->stamp < window[highest]->stamp && x->deadline != now) {
+				x->deadline = now;
+				on_loss(*x);
 			}
-			config.log(std::format("Acked:  {},  {}", window[0]->seq, ack));
-			window.discard(1);
-			--start;
-			if (++window_start >= config.get_seq_limit())
-				window_start -= config.get_seq_limit();
-			if (start < 0)
-				start = 0;
-			producer.notify_one();
 		}
+
+		while (window.size() && window[0]->acked) {
+			pop_front(now);
+			removed = true;
+		}
+		update_deadline();
+		if (removed)
+			producer.notify_all();
 	}
 
-	void reset() { start = 0; }
+	// wake up a producer blocked in try_push()
+	void shutdown()
+	{
+		{
+			std::scoped_lock lock { mutex };
+			m_shutdown = true;
+		}
+		producer.notify_all();
+	}
 
 private:
+	int window_limit() const { return std::clamp(static_cast<int>(m_window), 1, config.get_max_send_window_size()); }
+
+	void pop_front(int now)
+	{
+		if (!window[0]->acked)
+			on_acked(*window[0], now);
+		config.log(std::format("Acked:  {}", window[0]->seq));
+		window.discard(1);
+		if (++window_start >= config.get_seq_limit())
+			window_start -= config.get_seq_limit();
+	}
+
+	void on_acked(PHY_Unit& unit, int now)
+	{
+		unit.acked = true;
+		// * Karn: the ACK of a resent frame may be for either copy, no RTT from it
+		if (!unit.retries) {
+			double rtt = now - unit.sent_at;
+			if (m_srtt < 0) {
+				m_srtt = rtt;
+				m_rttvar = rtt / 2;
+			} else {
+				m_rttvar = 0.75 * m_rttvar + 0.25 * std::abs(m_srtt - rtt);
+				m_srtt = 0.875 * m_srtt + 0.125 * rtt;
+			}
+			m_rto = std::clamp(m_srtt + std::max(1.0, 4 * m_rttvar),
+				static_cast<double>(config.get_min_retransmit_timeout()), static_cast<double>(config.get_max_retransmit_timeout()));
+		}
+		// additive increase, one frame per window; only while the window is what holds us back
+		if (window.size() >= window_limit())
+			m_window = std::min(m_window + 1 / m_window, static_cast<double>(config.get_max_send_window_size()));
+	}
+
+	// multiplicative decrease, once per window: frames sent before the cut belong to the same loss
+	void on_loss(const PHY_Unit& unit)
+	{
+		if (unit.stamp <= m_recovery)
+			return;
+		m_window = std::max(static_cast<double>(config.get_window_size()), m_window / 2);
+		m_recovery = m_stamp;
+		config.log(std::format("Window:  {}", window_limit()));
+	}
+
+	void update_deadline()
+	{
+		int next = INT_MAX;
+		for (int i = 0; i < window.size(); ++i) {
+			auto& x = window[i];
+			if (x->sent && !x->acked)
+				next = std::min(next, x->deadline);
+		}
+		m_next_deadline.store(next, std::memory_order_relaxed);
+	}
+
 	Config& config;
 	RingBuffer<std::shared_ptr<PHY_Unit>> window;
 	std::mutex mutex;
 	std::condition_variable producer;
 	int window_start;
-	int start;
+	int64_t m_stamp = 0;
+	bool m_shutdown = false;
+
+	// congestion window, frames
+	double m_window;
+	// stamp up to which losses were already answered
+	int64_t m_recovery = 0;
+	// ticks, SRTT < 0 until the first sample
+	double m_srtt = -1;
+	double m_rttvar = 0;
+	double m_rto;
+	std::atomic_int m_next_deadline = INT_MAX;
 };
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,376 @@
+#pragma once
+
+#include "Config.hpp"
+#include "JuceHeader.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace Athernet {
+
+// Software sound card + cable, drives N audio callbacks (e.g. PHY_Layer) in lockstep blocks.
+// Each block the outputs of all nodes are mixed into every input through a per link
+// gain / delay / multipath filter, then AWGN is added at each receiver.
+// A node may run on its own clock (ppm offset), its samples are resampled to the channel clock and back.
+// Nothing waits for the wall clock unless asked to, so simulations run faster than real time.
+class SimulatedChannel {
+public:
+	enum class CollisionModel {
+		// overlapping signals add up, like on a real cable
+		SUPERPOSE,
+		// samples where two or more nodes transmit get random signs: same energy, no information
+		DESTROY,
+	};
+
+	struct Link {
+		// a full scale sender arrives at about 0.1 on the sound cards the PHY thresholds were tuned on,
+		// much louder input reads as a collision (see PHY_Layer)
+		float gain = 0.1f;
+		// samples
+		int delay = 0;
+		// multipath impulse response, taps[k] is the path delayed by another k samples
+		std::vector<float> taps { 1.0f };
+	};
+
+	struct Stats {
+		// channel clock
+		std::atomic<int64_t> samples = 0;
+		// at least one node transmitting
+		std::atomic<int64_t> busy_samples = 0;
+		// two or more nodes transmitting
+		std::atomic<int64_t> collided_samples = 0;
+		// a node clock ran ahead of its input / output stream
+		std::atomic<int64_t> underruns = 0;
+	};
+
+	SimulatedChannel(int block_size = 64, int sample_rate = 48'000, uint32_t seed = 0)
+		: m_block_size { block_size }
+		, m_sample_rate { sample_rate }
+		, m_random(seed)
+	{
+	}
+
+	~SimulatedChannel() { stop(); }
+
+	// pending: optional, work the node still has queued in samples, e.g. received but not demodulated;
+	// the channel holds back while it exceeds the max backlog (see set_max_backlog), INT_MAX holds it
+	// until the node catches up
+	int add_node(juce::AudioIODeviceCallback* callback, std::function<int()> pending = {})
+	{
+		assert(!m_prepared);
+		int id = static_cast<int>(m_nodes.size());
+		m_nodes.emplace_back();
+		auto& node = m_nodes.back();
+		node.callback = callback;
+		node.pending = std::move(pending);
+		node.input.resize(m_block_size);
+		node.output.resize(m_block_size);
+		node.mixed.resize(m_block_size);
+
+		// shared medium, every node hears every node including itself
+		for (auto& row : m_links)
+			row.emplace_back();
+		m_links.emplace_back(m_nodes.size());
+		return id;
+	}
+
+	// from -> to
+	Link& link(int from, int to)
+	{
+		assert(!m_prepared);
+		return m_links[from][to];
+	}
+
+	// AWGN standard deviation at the input of node
+	void set_noise(int node, float stddev) { m_nodes[node].noise = stddev; }
+
+	void set_noise(float stddev)
+	{
+		for (int i = 0; i < static_cast<int>(m_nodes.size()); ++i)
+			set_noise(i, stddev);
+	}
+
+	// the loudest of them, for the PHY thresholds (see Config::set_noise_floor)
+	float get_noise() const
+	{
+		float noise = 0;
+		for (const auto& node : m_nodes)
+			noise = std::max(noise, node.noise);
+		return noise;
+	}
+
+	// noise for a given SNR of the strongest other node at each receiver (full scale NRZI has power 1)
+	void set_snr_db(double snr_db)
+	{
+		const int n = static_cast<int>(m_nodes.size());
+		for (int to = 0; to < n; ++to) {
+			double signal_power = 0;
+			for (int from = 0; from < n; ++from) {
+				if (from == to)
+					continue;
+				const auto& link = m_links[from][to];
+				double power = 0;
+				for (auto tap : link.taps)
+					power += tap * tap;
+				signal_power = std::max(signal_power, power * link.gain * link.gain);
+			}
+			set_noise(to, static_cast<float>(sqrt(signal_power / pow(10.0, snr_db / 10))));
+		}
+	}
+
+	// node clock is (1 + ppm * 1e-6) times the channel clock
+	void set_clock_ppm(int node, double ppm)
+	{
+		assert(!m_prepared);
+		m_nodes[node].ratio = 1 + ppm * 1e-6;
+	}
+
+	void set_collision_model(CollisionModel model) { m_collision_model = model; }
+
+	// 1 = real time, 0 = as fast as possible
+	void set_speed(double speed) { m_speed = speed; }
+
+	void set_max_backlog(int samples) { m_max_backlog = samples; }
+
+	// run num_blocks blocks on the calling thread
+	void run(int num_blocks)
+	{
+		prepare();
+		for (int i = 0; i < num_blocks; ++i) {
+			wait_for_nodes();
+			step();
+		}
+	}
+
+	void start()
+	{
+		prepare();
+		running.store(true);
+		worker = std::thread(&SimulatedChannel::run_loop, this);
+	}
+
+	void stop()
+	{
+		running.store(false);
+		if (worker.joinable())
+			worker.join();
+		if (m_prepared) {
+			for (auto& node : m_nodes)
+				node.callback->audioDeviceStopped();
+			m_prepared = false;
+		}
+	}
+
+	const Stats& get_stats() const { return m_stats; }
+
+	// simulated seconds
+	double get_time() const { return static_cast<double>(m_stats.samples.load()) / m_sample_rate; }
+
+	int get_sample_rate() const { return m_sample_rate; }
+
+private:
+	// FIFO read with a fractional step, linear interpolation
+	class Resampler {
+	public:
+		void push(const float* x, int count) { m_data.insert(std::end(m_data), x, x + count); }
+
+		// false (and zero filled) if the stream ran dry
+		bool pull(float* out, int count, double step)
+		{
+			bool ok = true;
+			for (int i = 0; i < count; ++i, m_position += step) {
+				int index = static_cast<int>(m_position);
+				float frac = static_cast<float>(m_position - index);
+				if (index + (frac > 0) >= static_cast<int>(m_data.size())) {
+					std::fill(out + i, out + count, 0.0f);
+					m_position = static_cast<double>(m_data.size());
+					ok = false;
+					break;
+				}
+				out[i] = frac > 0 ? m_data[index] + (m_data[index + 1] - m_data[index]) * frac : m_data[index];
+			}
+			int consumed = std::min(static_cast<int>(m_position), static_cast<int>(m_data.size()));
+			m_data.erase(std::begin(m_data), std::begin(m_data) + consumed);
+			m_position -= consumed;
+			return ok;
+		}
+
+	private:
+		std::vector<float> m_data;
+		double m_position = 0;
+	};
+
+	struct Node {
+		juce::AudioIODeviceCallback* callback = nullptr;
+		std::function<int()> pending;
+		float noise = 0;
+		double ratio = 1;
+		// node clock samples owed to this node
+		double clock_debt = 0;
+		Resampler tx;
+		Resampler rx;
+		// node clock
+		std::vector<float> input;
+		std::vector<float> output;
+		// channel clock
+		std::vector<float> mixed;
+		std::vector<float> history;
+	};
+
+	void prepare()
+	{
+		if (m_prepared)
+			return;
+
+		int longest = 0;
+		for (auto& row : m_links) {
+			for (auto& link : row) {
+				longest = std::max(longest, link.delay + static_cast<int>(link.taps.size()));
+			}
+		}
+		m_history_size = 1;
+		while (m_history_size < longest + m_block_size)
+			m_history_size <<= 1;
+
+		// two blocks of latency each way, like a sound card; leaves a block of slack for clock drift
+		std::vector<float> silence(2 * m_block_size + 1);
+		for (auto& node : m_nodes) {
+			node.history.assign(m_history_size, 0.0f);
+			node.tx.push(silence.data(), static_cast<int>(silence.size()));
+			node.rx.push(silence.data(), static_cast<int>(silence.size()));
+			node.callback->audioDeviceAboutToStart(nullptr);
+		}
+		m_prepared = true;
+	}
+
+	void run_loop()
+	{
+		using namespace std::chrono;
+		auto started = steady_clock::now();
+		int64_t started_samples = m_stats.samples.load();
+		while (running.load()) {
+			wait_for_nodes();
+			step();
+			if (m_speed > 0) {
+				auto simulated = duration<double>((m_stats.samples.load() - started_samples) / (m_sample_rate * m_speed));
+				std::this_thread::sleep_until(started + duration_cast<steady_clock::duration>(simulated));
+			}
+		}
+	}
+
+	void wait_for_nodes()
+	{
+		for (auto& node : m_nodes) {
+			if (!node.pending)
+				continue;
+			while (node.pending() > m_max_backlog)
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
+	}
+
+	// one block of the channel clock
+	void step()
+	{
+		const int n = static_cast<int>(m_nodes.size());
+		const int mask = m_history_size - 1;
+		const int64_t now = m_stats.samples.load();
+
+		// transmitted signals onto the channel clock
+		for (auto& node : m_nodes) {
+			if (!node.tx.pull(node.mixed.data(), m_block_size, node.ratio))
+				m_stats.underruns.fetch_add(1);
+			for (int t = 0; t < m_block_size; ++t)
+				node.history[(now + t) & mask] = node.mixed[t];
+		}
+
+		int64_t busy = 0, collided = 0;
+		for (int t = 0; t < m_block_size; ++t) {
+			int active = 0;
+			for (auto& node : m_nodes)
+				active += fabs(node.history[(now + t) & mask]) > 1e-6f;
+			busy += active > 0;
+			collided += active > 1;
+			if (active > 1 && m_collision_model == CollisionModel::DESTROY) {
+				for (auto& node : m_nodes) {
+					auto& x = node.history[(now + t) & mask];
+					if (fabs(x) > 1e-6f)
+						x = m_coin(m_random) ? x : -x;
+				}
+			}
+		}
+		m_stats.busy_samples.fetch_add(busy);
+		m_stats.collided_samples.fetch_add(collided);
+
+		// mix into every receiver
+		for (int to = 0; to < n; ++to) {
+			auto& receiver = m_nodes[to];
+			std::fill(std::begin(receiver.mixed), std::end(receiver.mixed), 0.0f);
+			for (int from = 0; from < n; ++from) {
+				const auto& link = m_links[from][to];
+				if (link.gain == 0)
+					continue;
+				const auto& history = m_nodes[from].history;
+				for (int k = 0; k < static_cast<int>(link.taps.size()); ++k) {
+					float gain = link.gain * link.taps[k];
+					int64_t offset = now - link.delay - k;
+					for (int t = 0; t < m_block_size; ++t)
+						receiver.mixed[t] += gain * history[(offset + t) & mask];
+				}
+			}
+			if (receiver.noise > 0) {
+				std::normal_distribution<float> awgn(0, receiver.noise);
+				for (int t = 0; t < m_block_size; ++t)
+					receiver.mixed[t] += awgn(m_random);
+			}
+		}
+		// history of the senders is still needed above, only now hand the blocks over
+		for (auto& node : m_nodes)
+			node.rx.push(node.mixed.data(), m_block_size);
+
+		// callbacks as the node clocks tick
+		juce::AudioIODeviceCallbackContext context {};
+		for (auto& node : m_nodes) {
+			node.clock_debt += m_block_size * node.ratio;
+			while (node.clock_debt >= m_block_size) {
+				node.clock_debt -= m_block_size;
+				if (!node.rx.pull(node.input.data(), m_block_size, 1 / node.ratio))
+					m_stats.underruns.fetch_add(1);
+
+				const float* inputs[] = { node.input.data() };
+				float* outputs[] = { node.output.data() };
+				node.callback->audioDeviceIOCallbackWithContext(inputs, 1, outputs, 1, m_block_size, context);
+				node.tx.push(node.output.data(), m_block_size);
+			}
+		}
+
+		m_stats.samples.fetch_add(m_block_size);
+	}
+
+	int m_block_size;
+	int m_sample_rate;
+	std::vector<Node> m_nodes;
+	std::vector<std::vector<Link>> m_links;
+
+	CollisionModel m_collision_model = CollisionModel::SUPERPOSE;
+	double m_speed = 0;
+	// * above the demodulator look-ahead, otherwise it waits for samples the channel holds back
+	int m_max_backlog = 2 * Config::get_instance().get_max_view_length();
+
+	std::mt19937 m_random;
+	std::bernoulli_distribution m_coin;
+
+	int m_history_size = 0;
+	bool m_prepared = false;
+	Stats m_stats;
+
+	std::atomic_bool running = false;
+	std::thread worker;
+};
+
+}
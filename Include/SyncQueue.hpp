@@ -1,5 +1,6 @@
 #pragma once
 
+#include <condition_variable>
 #include <mutex>
 #include <queue>
 
@@ -22,10 +23,11 @@ public:
 		consumer.notify_one();
 	}
 
+	// block until an item arrives, false once shutdown() is called and the queue is drained
 	bool pop(T& item)
 	{
 		std::unique_lock lock { mutex };
-		consumer.wait_for(lock, 10ms, [&]() { return !m_queue.empty(); });
+		consumer.wait(lock, [&]() { return !m_queue.empty() || m_shutdown; });
 		if (!m_queue.empty()) {
 			item = std::move(m_queue.front());
 			m_queue.pop();
@@ -35,8 +37,19 @@ public:
 		}
 	}
 
+	// wake up the consumer for good
+	void shutdown()
+	{
+		{
+			std::scoped_lock lock { mutex };
+			m_shutdown = true;
+		}
+		consumer.notify_all();
+	}
+
 	bool try_pop(T& item)
 	{
+		std::scoped_lock lock { mutex };
 		if (!m_queue.empty()) {
 			item = std::move(m_queue.front());
 			m_queue.pop();
@@ -46,9 +59,16 @@ public:
 		}
 	}
 
+	size_t size()
+	{
+		std::scoped_lock lock { mutex };
+		return m_queue.size();
+	}
+
 	// private:
 	std::queue<T> m_queue;
 	std::condition_variable consumer;
 	std::mutex mutex;
+	bool m_shutdown = false;
 };
 }
\ No newline at end of file
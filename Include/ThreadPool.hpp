@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Athernet {
+
+// Work stealing pool for the coding work (LT encode / decode of independent chunks).
+// Every worker has its own deque: it takes its newest task first, idle workers steal the oldest
+// task of another. Tasks submitted from a worker stay on its deque, others go round robin.
+class ThreadPool {
+	using Task = std::function<void()>;
+
+public:
+	// Singleton
+	static ThreadPool& get_instance()
+	{
+		static ThreadPool instance;
+		return instance;
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	~ThreadPool()
+	{
+		{
+			std::scoped_lock lock { m_mutex };
+			running.store(false);
+		}
+		m_wake.notify_all();
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+	void submit(Task task)
+	{
+		int target = t_index >= 0 && t_owner == this
+			? t_index
+			: static_cast<int>(m_next.fetch_add(1) % static_cast<unsigned>(num_threads()));
+		{
+			std::scoped_lock lock { m_queues[target]->mutex };
+			m_queues[target]->tasks.push_back(std::move(task));
+			m_pending.fetch_add(1);
+		}
+		// a worker counts itself asleep before it checks m_pending, so one of the two sees the other;
+		// it holds m_mutex until it waits, so the notify can't fall in between
+		if (m_sleeping.load()) {
+			{
+				std::scoped_lock lock { m_mutex };
+			}
+			m_wake.notify_one();
+		}
+	}
+
+	template <typename F> auto async(F f) -> std::future<decltype(f())>
+	{
+		auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::move(f));
+		auto result = task->get_future();
+		submit([task] { (*task)(); });
+		return result;
+	}
+
+	int num_threads() const { return static_cast<int>(m_queues.size()); }
+
+private:
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	ThreadPool()
+	{
+		int n = std::max(2, static_cast<int>(std::thread::hardware_concurrency()));
+		for (int i = 0; i < n; ++i)
+			m_queues.push_back(std::make_unique<Queue>());
+		running.store(true);
+		for (int i = 0; i < n; ++i)
+			workers.emplace_back(&ThreadPool::work, this, i);
+	}
+
+	// * a task is counted while it is on a queue (both under the queue lock, m_mutex only guards
+	// sleeping), a worker woken by a count above 0 that finds nothing goes back to sleep instead of
+	// spinning on a stale count
+	bool take(int self, Task& task)
+	{
+		{
+			auto& own = *m_queues[self];
+			std::scoped_lock lock { own.mutex };
+			if (own.tasks.size()) {
+				task = std::move(own.tasks.back());
+				own.tasks.pop_back();
+				taken();
+				return true;
+			}
+		}
+		for (int k = 1; k < num_threads(); ++k) {
+			auto& other = *m_queues[(self + k) % num_threads()];
+			std::scoped_lock lock { other.mutex };
+			if (other.tasks.size()) {
+				task = std::move(other.tasks.front());
+				other.tasks.pop_front();
+				taken();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void taken() { m_pending.fetch_sub(1); }
+
+	void work(int self)
+	{
+		t_index = self;
+		t_owner = this;
+		Task task;
+		while (true) {
+			{
+				std::unique_lock lock { m_mutex };
+				m_sleeping.fetch_add(1);
+				m_wake.wait(lock, [&] { return m_pending.load() > 0 || !running.load(); });
+				m_sleeping.fetch_sub(1);
+				if (!m_pending.load() && !running.load())
+					return;
+			}
+			if (!take(self, task))
+				continue;
+			task();
+			task = nullptr;
+		}
+	}
+
+	std::vector<std::unique_ptr<Queue>> m_queues;
+	std::atomic<unsigned> m_next = 0;
+
+	// tasks queued anywhere, workers sleep on m_wake while 0
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::atomic_int m_pending = 0;
+	std::atomic_int m_sleeping = 0;
+
+	static inline thread_local int t_index = -1;
+	static inline thread_local ThreadPool* t_owner = nullptr;
+
+	std::atomic_bool running;
+	std::vector<std::thread> workers;
+};
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace Athernet {
+
+// Waveforms that come up again and again (control frames, or the fixed part of them), each built
+// once on first use, all in one contiguous arena. A span from get() is good until the next get();
+// once capacity samples are in use the arena starts over. One thread only.
+template <typename T> class WaveformCache {
+public:
+	explicit WaveformCache(int capacity)
+		: m_capacity { static_cast<size_t>(capacity) }
+	{
+		m_arena.reserve(m_capacity);
+	}
+
+	// the waveform of key; on a miss build(std::vector<T>&) appends it to the arena
+	template <typename Build> std::span<const T> get(uint64_t key, Build&& build)
+	{
+		auto it = m_entries.find(key);
+		if (it == m_entries.end()) {
+			if (m_arena.size() >= m_capacity) {
+				m_arena.clear();
+				m_entries.clear();
+			}
+			size_t offset = m_arena.size();
+			build(m_arena);
+			it = m_entries.emplace(key, Entry { offset, m_arena.size() - offset }).first;
+		}
+		return std::span<const T>(m_arena).subspan(it->second.offset, it->second.length);
+	}
+
+private:
+	struct Entry {
+		size_t offset;
+		size_t length;
+	};
+
+	size_t m_capacity;
+	std::vector<T> m_arena;
+	std::unordered_map<uint64_t, Entry> m_entries;
+};
+
+}
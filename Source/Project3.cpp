@@ -4,6 +4,7 @@
 #include "LT_Encode.hpp"
 #include "MAC_Layer.hpp"
 #include "PHY_Layer.hpp"
+#include "SimulatedChannel.hpp"
 #include <EthLayer.h>
 #include <IcmpLayer.h>
 #include <Packet.h>
@@ -11,15 +12,20 @@
 #include <PcapLiveDeviceList.h>
 #include <SystemUtils.h>
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
+#include <filesystem>
 #include <ctime>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <random>
 #include <string>
+#include <thread>
 #include <vector>
 
 template <typename T>
@@ -90,6 +96,204 @@ void ping_async(Athernet::IP_Layer* ip_layer, std::string ip, int times, double
 	}
 }
 
+// one MAC + PHY stack, no sound card or pcap attached
+struct SimulatedNode {
+	SimulatedNode(int id)
+		: sender(control, sender_window)
+		, receiver(control, recv_queue, sender_window, receiver_window)
+		, phy_layer(control, sender, receiver)
+	{
+		phy_layer.set_self_id(id);
+	}
+
+	Athernet::Protocol_Control control;
+	Athernet::SyncQueue<Athernet::BitBuffer> recv_queue;
+	Athernet::SenderSlidingWindow sender_window;
+	Athernet::ReceiverSlidingWindow receiver_window;
+	Athernet::MAC_Sender<float> sender;
+	Athernet::MAC_Receiver<float> receiver;
+	Athernet::PHY_Layer<float> phy_layer;
+};
+
+const char* modulation_name(Athernet::Modulation modulation)
+{
+	switch (modulation) {
+	case Athernet::Modulation::OFDM_QPSK:
+		return "OFDM QPSK";
+	case Athernet::Modulation::OFDM_16QAM:
+		return "OFDM 16-QAM";
+	default:
+		return "4B5B NRZI";
+	}
+}
+
+const char* code_rate_name(Athernet::CodeRate rate)
+{
+	switch (rate) {
+	case Athernet::CodeRate::R1_2:
+		return "1/2";
+	case Athernet::CodeRate::R2_3:
+		return "2/3";
+	case Athernet::CodeRate::R3_4:
+		return "3/4";
+	default:
+		return "none";
+	}
+}
+
+// every node sends num_packets to its peer (id ^ 1) over the simulated channel, reports goodput
+void simulate(int num_nodes, double snr_db, int num_packets, int packet_length, double time_limit,
+	Athernet::Modulation modulation, bool adaptive, Athernet::CodeRate rate)
+{
+	// * before the channel: it stops (and calls into the nodes) when it goes
+	std::vector<std::unique_ptr<SimulatedNode>> nodes;
+	Athernet::SimulatedChannel channel;
+	for (int i = 0; i < num_nodes; ++i) {
+		auto node = nodes.emplace_back(std::make_unique<SimulatedNode>(i)).get();
+		node->phy_layer.set_modulation(modulation);
+		node->phy_layer.set_link_adaptation(adaptive);
+		node->phy_layer.set_code_rate(rate);
+		channel.add_node(&node->phy_layer, [node] {
+			return node->phy_layer.synth_idle() ? node->phy_layer.pending_samples() : INT_MAX;
+		});
+	}
+	channel.set_snr_db(snr_db);
+	Athernet::Config::get_instance().set_noise_floor(channel.get_noise());
+
+	std::mt19937 random(0);
+	int expected = 0;
+	for (int i = 0; i < num_nodes; ++i) {
+		if ((i ^ 1) >= num_nodes)
+			continue;
+		for (int j = 0; j < num_packets; ++j) {
+			Athernet::BitBuffer frame;
+			for (int k = 0; k < packet_length; ++k)
+				frame.push_back(random() & 1);
+			// not LT coded
+			frame.push_back(0);
+			nodes[i]->phy_layer.send_frame(frame);
+			++expected;
+		}
+	}
+
+	int delivered = 0;
+	Athernet::BitBuffer payload;
+	while (delivered < expected && channel.get_time() < time_limit) {
+		// 0.1 s
+		channel.run(75);
+		for (auto& node : nodes) {
+			while (node->recv_queue.try_pop(payload))
+				++delivered;
+		}
+	}
+
+	const auto& stats = channel.get_stats();
+	double time = channel.get_time();
+	std::cerr << std::format("Nodes: {}   SNR: {} dB   {}   code {}\n", num_nodes, snr_db,
+		adaptive ? "adaptive" : modulation_name(modulation), code_rate_name(rate));
+	std::cerr << std::format("\tDelivered {} / {} in {:.1f}s, goodput {:.0f} bps\n", delivered, expected, time,
+		delivered * packet_length / time);
+	std::cerr << std::format("\tBusy {:.1f}%, collided {:.1f}%\n", stats.busy_samples.load() * 100.0 / stats.samples.load(),
+		stats.collided_samples.load() * 100.0 / stats.samples.load());
+	if (!stats.busy_samples.load())
+		std::cerr << "\tNothing went on air: the carrier never looked free\n";
+
+	int64_t acks = 0, piggybacked = 0, acked_frames = 0, ack_samples = 0, fixed_ack_samples = 0;
+	int64_t modulated[3] = {}, coded[4] = {};
+	for (auto& node : nodes) {
+		const auto& mac_stats = node->sender.get_mac_stats();
+		for (int i = 0; i < 3; ++i)
+			modulated[i] += mac_stats.modulated[i].load();
+		for (int i = 0; i < 4; ++i)
+			coded[i] += mac_stats.coded[i].load();
+		acks += mac_stats.acks.load();
+		piggybacked += mac_stats.piggybacked.load();
+		acked_frames += mac_stats.acked_frames.load();
+		ack_samples += mac_stats.ack_samples.load();
+		fixed_ack_samples += mac_stats.fixed_ack_samples.load();
+	}
+	std::cerr << std::format("\tACKs {} standalone, {} piggybacked, {:.2f} frames per ACK\n", acks, piggybacked,
+		acked_frames / std::max(1.0, static_cast<double>(acks + piggybacked)));
+	std::cerr << std::format("\tACK airtime {:.2f}s, {:.2f}s saved against 4 padded copies\n",
+		static_cast<double>(ack_samples) / channel.get_sample_rate(),
+		static_cast<double>(fixed_ack_samples - ack_samples) / channel.get_sample_rate());
+	std::cerr << std::format("\tData frames: {} NRZI, {} QPSK, {} 16-QAM\n", modulated[0], modulated[1], modulated[2]);
+	std::cerr << std::format(
+		"\tCode rates: {} none, {} 1/2, {} 2/3, {} 3/4\n", coded[0], coded[1], coded[2], coded[3]);
+}
+
+// node 0 sends a file to node 1 with LT_Send (binary: LT_Send_File, written to output) until node 1 has decoded it
+void simulate_file(const std::string& file, bool binary, const std::string& output, double snr_db, double time_limit,
+	Athernet::Modulation modulation, bool adaptive, Athernet::CodeRate rate)
+{
+	// * before the channel: it stops (and calls into the nodes) when it goes
+	std::vector<std::unique_ptr<SimulatedNode>> nodes;
+	Athernet::SimulatedChannel channel;
+	for (int i = 0; i < 2; ++i) {
+		auto node = nodes.emplace_back(std::make_unique<SimulatedNode>(i)).get();
+		node->phy_layer.set_modulation(modulation);
+		node->phy_layer.set_link_adaptation(adaptive);
+		node->phy_layer.set_code_rate(rate);
+		channel.add_node(&node->phy_layer, [node] {
+			return node->phy_layer.synth_idle() ? node->phy_layer.pending_samples() : INT_MAX;
+		});
+	}
+	channel.set_snr_db(snr_db);
+	Athernet::Config::get_instance().set_noise_floor(channel.get_noise());
+
+	// * the sender hears about decoded chunks over the air as on a real link, the simulation ends as
+	// soon as node 1 has the whole file
+	std::atomic_bool done = false;
+	// done also once the sender gives up, this only once node 1 has it all
+	std::atomic_bool decoded = false;
+	nodes[1]->receiver.set_on_file_complete([&](int, bool last) {
+		if (last) {
+			decoded.store(true);
+			done.store(true);
+		}
+	});
+	auto chunk_done = [&](int transfer, int chunk) {
+		return done.load() || nodes[0]->phy_layer.lt_decoded(transfer, chunk);
+	};
+	if (binary)
+		nodes[1]->receiver.set_output_file(output);
+	std::thread sender([&] {
+		if (binary) {
+			Athernet::LT_Send_File(&nodes[0]->phy_layer, file, chunk_done);
+		} else {
+			Athernet::LT_Send(&nodes[0]->phy_layer, file, chunk_done);
+		}
+		// nothing more to wait for once everything is sent
+		done.store(true);
+	});
+
+	while (!done.load() && channel.get_time() < time_limit) {
+		channel.run(75);
+	}
+	done.store(true);
+	sender.join();
+
+	double time = channel.get_time();
+	if (!decoded.load()) {
+		std::cerr << std::format("File: not decoded in {:.1f}s\n", time);
+		return;
+	}
+	int64_t length = 0;
+	Athernet::BitBuffer received;
+	if (binary) {
+		std::error_code error;
+		auto size = std::filesystem::file_size(output, error);
+		if (error) {
+			std::cerr << "Unable to read " << output << "!\n";
+			return;
+		}
+		length = static_cast<int64_t>(size) * 8;
+	} else if (nodes[1]->receiver.get_file_queue().try_pop(received)) {
+		length = received.size();
+	}
+	std::cerr << std::format("File: {} bits in {:.1f}s, goodput {:.0f} bps\n", length, time, length / time);
+}
+
 void* Project2_main_loop(void*)
 {
 	// Use RAII pattern to take care of initializing/shutting down JUCE
@@ -161,6 +365,13 @@ void* Project2_main_loop(void*)
 	// std::jthread ping_thread;
 
 	ping_interrupt.store(false);
+	auto modulation = Athernet::Config::get_instance().get_phy_modulation();
+	bool adaptive = Athernet::Config::get_instance().get_phy_link_adaptation();
+	auto rate = Athernet::Config::get_instance().get_phy_code_rate();
+	// LT transfers go on until the receiver reports them decoded
+	auto peer_decoded = [physical_layer](int transfer, int chunk) {
+		return physical_layer->lt_decoded(transfer, chunk);
+	};
 	// ping_async(ip_layer.get(), "1.1.1.1", 5, 1, 10, std::ref(ping_interrupt));
 	while (true) {
 		std::cin >> s;
@@ -171,7 +382,16 @@ void* Project2_main_loop(void*)
 		} else if (s == "s") {
 			std::string file;
 			std::cin >> file;
-			Athernet::LT_Send(physical_layer, file);
+			Athernet::LT_Send(physical_layer, file, peer_decoded);
+		} else if (s == "sf") {
+			std::string path;
+			std::cin >> path;
+			Athernet::LT_Send_File(physical_layer, path, peer_decoded);
+		} else if (s == "rf") {
+			// files received from now on
+			std::string path;
+			std::cin >> path;
+			ip_layer->mac_layer.m_receiver.set_output_file(path);
 		} else if (s == "ping") {
 			std::string ip;
 			std::cin >> ip;
@@ -202,6 +422,63 @@ void* Project2_main_loop(void*)
 			// 	ping_async, ip_layer.get(), ip, times, interval, length, std::ref(ping_interrupt));
 			ping_async(ip_layer.get(), ip, times, interval, length, ping_interrupt);
 
+		} else if (s == "sim") {
+			int nodes, num, len;
+			double snr;
+			std::cin >> nodes >> snr >> num >> len;
+			simulate(nodes, snr, num, len, 60, modulation, adaptive, rate);
+		} else if (s == "simfile") {
+			std::string file;
+			double snr;
+			std::cin >> file >> snr;
+			simulate_file(file, false, "", snr, 600, modulation, adaptive, rate);
+		} else if (s == "simbin") {
+			std::string file, output;
+			double snr;
+			std::cin >> file >> output >> snr;
+			simulate_file(file, true, output, snr, 3600, modulation, adaptive, rate);
+		} else if (s == "mod") {
+			// payload modulation of this link and of the simulations: nrzi / qpsk / 16qam, or auto to
+			// follow what the peer reports with the code rate too (starting from the current ones)
+			std::string name;
+			std::cin >> name;
+			adaptive = name == "auto";
+			if (name == "qpsk") {
+				modulation = Athernet::Modulation::OFDM_QPSK;
+			} else if (name == "16qam") {
+				modulation = Athernet::Modulation::OFDM_16QAM;
+			} else if (!adaptive) {
+				modulation = Athernet::Modulation::NRZI_4B5B;
+			}
+			physical_layer->set_modulation(modulation);
+			physical_layer->set_link_adaptation(adaptive);
+			std::cerr << (adaptive ? "adaptive" : modulation_name(modulation)) << "\n";
+		} else if (s == "fec") {
+			// code rate of this link and of the simulations: none / 1/2 / 2/3 / 3/4; of its NRZI frames
+			// only while the modulation is auto
+			std::string name;
+			std::cin >> name;
+			if (name == "1/2") {
+				rate = Athernet::CodeRate::R1_2;
+			} else if (name == "2/3") {
+				rate = Athernet::CodeRate::R2_3;
+			} else if (name == "3/4") {
+				rate = Athernet::CodeRate::R3_4;
+			} else {
+				rate = Athernet::CodeRate::NONE;
+			}
+			physical_layer->set_code_rate(rate);
+			std::cerr << "code " << code_rate_name(rate) << "\n";
+		} else if (s == "crc") {
+			// payload CRC width of this node and of the simulations: 8 / 16 / 32, the peer has to match
+			int length;
+			std::cin >> length;
+			if (length != 8 && length != 16 && length != 32) {
+				std::cerr << "Wrong usage!\n";
+				continue;
+			}
+			Athernet::Config::get_instance().set_payload_crc_length(length);
+			std::cerr << "CRC" << length << "\n";
 		} else if (s == "e") {
 			ping_interrupt.store(true);
 			break;
@@ -0,0 +1,324 @@
+// Offline replay of recorded audio through the receive stack (no audio device needed).
+//
+// Usage: Replay <file> [--format wav|f32|txt] [--id N] [--block N] [--channel N]
+//   wav : RIFF WAVE, PCM 16/24/32 bit or IEEE float
+//   f32 : raw little endian float32, mono
+//   txt : whitespace separated floats, e.g. received.txt dumped by RingBuffer::dump
+
+#include "Config.hpp"
+#include "MAC_Receiver.hpp"
+#include "Protocol_Control.hpp"
+#include "ReceiverSlidingWindow.hpp"
+#include "SenderSlidingWindow.hpp"
+#include "SyncQueue.hpp"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+class SampleReader {
+public:
+	virtual ~SampleReader() = default;
+
+	// returns number of samples read, 0 at end of file
+	virtual int read(float* dest, int count) = 0;
+
+	virtual int sample_rate() const { return 48'000; }
+};
+
+class RawFloatReader : public SampleReader {
+public:
+	RawFloatReader(const std::string& file)
+		: fin(file, std::ios::binary)
+	{
+		if (!fin) {
+			std::cerr << "Unable to open " << file << "!\n";
+			exit(1);
+		}
+	}
+
+	int read(float* dest, int count) override
+	{
+		fin.read(reinterpret_cast<char*>(dest), count * sizeof(float));
+		return static_cast<int>(fin.gcount() / sizeof(float));
+	}
+
+private:
+	std::ifstream fin;
+};
+
+class TextReader : public SampleReader {
+public:
+	TextReader(const std::string& file)
+		: fin(file)
+	{
+		if (!fin) {
+			std::cerr << "Unable to open " << file << "!\n";
+			exit(1);
+		}
+	}
+
+	int read(float* dest, int count) override
+	{
+		int n = 0;
+		while (n < count && fin >> dest[n])
+			++n;
+		return n;
+	}
+
+private:
+	std::ifstream fin;
+};
+
+class WavReader : public SampleReader {
+public:
+	WavReader(const std::string& file, int channel)
+		: fin(file, std::ios::binary)
+		, m_channel { channel }
+	{
+		if (!fin) {
+			std::cerr << "Unable to open " << file << "!\n";
+			exit(1);
+		}
+
+		char riff[12];
+		fin.read(riff, 12);
+		if (!fin || memcmp(riff, "RIFF", 4) || memcmp(riff + 8, "WAVE", 4)) {
+			std::cerr << "Not a WAVE file!\n";
+			exit(1);
+		}
+
+		// walk chunks until "data"
+		while (true) {
+			char id[4];
+			uint32_t size = 0;
+			fin.read(id, 4);
+			size = read_le(4);
+			if (!fin) {
+				std::cerr << "No data chunk!\n";
+				exit(1);
+			}
+			if (!memcmp(id, "fmt ", 4)) {
+				m_format = read_le(2);
+				m_channels = read_le(2);
+				m_sample_rate = read_le(4);
+				read_le(4); // byte rate
+				read_le(2); // block align
+				m_bits = read_le(2);
+				if (m_format == 0xFFFE && size >= 40) {
+					// WAVE_FORMAT_EXTENSIBLE, sub format is the first 2 bytes of the GUID
+					read_le(2);
+					read_le(2);
+					read_le(4);
+					m_format = read_le(2);
+					fin.seekg(size - 26, std::ios::cur);
+				} else {
+					fin.seekg(size - 16, std::ios::cur);
+				}
+			} else if (!memcmp(id, "data", 4)) {
+				m_remaining = size;
+				break;
+			} else {
+				fin.seekg(size + (size & 1), std::ios::cur);
+			}
+		}
+
+		if (!((m_format == 1 && (m_bits == 16 || m_bits == 24 || m_bits == 32))
+				|| (m_format == 3 && m_bits == 32))) {
+			std::cerr << std::format("Unsupported WAVE format {} ({} bits)!\n", m_format, m_bits);
+			exit(1);
+		}
+		if (m_channel >= m_channels) {
+			std::cerr << "Channel out of range!\n";
+			exit(1);
+		}
+		m_frame.resize(m_channels * m_bits / 8);
+	}
+
+	int read(float* dest, int count) override
+	{
+		int n = 0;
+		while (n < count && m_remaining >= m_frame.size()) {
+			fin.read(reinterpret_cast<char*>(m_frame.data()), m_frame.size());
+			if (!fin)
+				break;
+			m_remaining -= static_cast<uint32_t>(m_frame.size());
+			dest[n++] = decode(m_frame.data() + m_channel * m_bits / 8);
+		}
+		return n;
+	}
+
+	int sample_rate() const override { return m_sample_rate; }
+
+private:
+	uint32_t read_le(int num_bytes)
+	{
+		uint8_t bytes[4] = {};
+		fin.read(reinterpret_cast<char*>(bytes), num_bytes);
+		uint32_t x = 0;
+		for (int i = 0; i < num_bytes; ++i)
+			x |= static_cast<uint32_t>(bytes[i]) << (8 * i);
+		return x;
+	}
+
+	float decode(const uint8_t* p) const
+	{
+		if (m_format == 3) {
+			float x;
+			memcpy(&x, p, sizeof(float));
+			return x;
+		}
+		if (m_bits == 16) {
+			return static_cast<int16_t>(p[0] | (p[1] << 8)) / 32768.0f;
+		} else if (m_bits == 24) {
+			int32_t x = (p[0] << 8) | (p[1] << 16) | (p[2] << 24);
+			return (x >> 8) / 8388608.0f;
+		} else {
+			int32_t x = p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+			return x / 2147483648.0f;
+		}
+	}
+
+	std::ifstream fin;
+	int m_channel;
+	int m_format = 0;
+	int m_channels = 0;
+	int m_sample_rate = 0;
+	int m_bits = 0;
+	uint32_t m_remaining = 0;
+	std::vector<uint8_t> m_frame;
+};
+
+int main(int argc, char* argv[])
+{
+	using namespace std::chrono;
+
+	if (argc < 2) {
+		std::cerr << "Usage: Replay <file> [--format wav|f32|txt] [--id N] [--block N] [--channel N]\n";
+		return 1;
+	}
+
+	std::string file = argv[1];
+	std::string format;
+	int id = 0;
+	int block = 64;
+	int channel = 0;
+	for (int i = 2; i + 1 < argc; i += 2) {
+		std::string opt = argv[i];
+		if (opt == "--format") {
+			format = argv[i + 1];
+		} else if (opt == "--id") {
+			id = std::stoi(argv[i + 1]);
+		} else if (opt == "--block") {
+			block = std::stoi(argv[i + 1]);
+		} else if (opt == "--channel") {
+			channel = std::stoi(argv[i + 1]);
+		} else {
+			std::cerr << "Unknown option " << opt << "\n";
+			return 1;
+		}
+	}
+	if (format.empty()) {
+		auto ext = file.substr(file.find_last_of('.') + 1);
+		format = (ext == "wav") ? "wav" : (ext == "txt") ? "txt" : "f32";
+	}
+
+	std::unique_ptr<SampleReader> reader;
+	if (format == "wav") {
+		reader = std::make_unique<WavReader>(file, channel);
+	} else if (format == "txt") {
+		reader = std::make_unique<TextReader>(file);
+	} else {
+		reader = std::make_unique<RawFloatReader>(file);
+	}
+	if (reader->sample_rate() != 48'000) {
+		std::cerr << std::format("Warning: sample rate is {}, expected 48000\n", reader->sample_rate());
+	}
+
+	auto& config = Athernet::Config::get_instance();
+	config.set_self_id(id);
+
+	Athernet::Protocol_Control control;
+	Athernet::SyncQueue<Athernet::BitBuffer> recv_queue;
+	Athernet::SenderSlidingWindow sender_window;
+	Athernet::ReceiverSlidingWindow receiver_window;
+	Athernet::MAC_Receiver<float> receiver(control, recv_queue, sender_window, receiver_window);
+
+	// trailing silence flushes the last frame out of the extractor
+	int tail = config.get_max_view_length() + config.get_preamble_length();
+	std::vector<float> buffer(block);
+	int64_t total = 0;
+	bool ended = false;
+
+	auto started = steady_clock::now();
+	while (true) {
+		int n = ended ? std::min(block, tail) : reader->read(buffer.data(), block);
+		if (!ended && n < block) {
+			ended = true;
+			std::fill(std::begin(buffer) + n, std::end(buffer), 0.0f);
+			n = block;
+		} else if (ended) {
+			std::fill(std::begin(buffer), std::end(buffer), 0.0f);
+			tail -= n;
+			if (n <= 0)
+				break;
+		}
+		// don't overrun the ring buffer
+		while (config.get_physical_buffer_size() - receiver.pending_samples() < n) {
+			std::this_thread::sleep_for(50us);
+		}
+		receiver.push_stream(buffer.data(), n);
+		total += n;
+	}
+
+	// wait for the extractor to go idle
+	int last_pending = -1;
+	auto last_change = steady_clock::now();
+	auto idle = last_change;
+	while (true) {
+		idle = steady_clock::now();
+		int pending = receiver.pending_samples();
+		if (pending < config.get_preamble_length())
+			break;
+		if (pending != last_pending) {
+			last_pending = pending;
+			last_change = idle;
+		} else if (idle - last_change > 500ms) {
+			// the timeout without progress isn't decoding time
+			idle = last_change;
+			break;
+		}
+		std::this_thread::sleep_for(100us);
+	}
+	auto used = duration_cast<duration<double>>(idle - started).count();
+
+	int delivered = 0;
+	Athernet::BitBuffer payload;
+	std::this_thread::sleep_for(50ms);
+	while (recv_queue.try_pop(payload)) {
+		++delivered;
+	}
+
+	const auto& stats = receiver.get_phy_stats();
+	std::cerr << "--------[Replay]--------\n";
+	std::cerr << std::format("     Samples:       {}\n", total);
+	std::cerr << std::format("     Time:          {:.3f}s\n", used);
+	std::cerr << std::format("     Samples/sec:   {:.0f} ({:.1f}x real time)\n", total / used, total / used / 48'000);
+	std::cerr << std::format("     Preambles:     {}\n", stats.preambles.load());
+	std::cerr << std::format("     Good frames:   {}\n", stats.good.load());
+	std::cerr << std::format("     Bad length:    {}\n", stats.bad_length.load());
+	std::cerr << std::format("     Header CRC:    {}\n", stats.bad_header.load());
+	std::cerr << std::format("     Payload CRC:   {}\n", stats.bad_payload.load());
+	std::cerr << std::format("     Delivered:     {}\n", delivered);
+
+	return 0;
+}